@@ -0,0 +1,115 @@
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include <qtest.h>
+
+#include <kbookmark.h>
+#include <kbookmarkmanager.h>
+#include <QDir>
+#include <QDomDocument>
+#include <QFile>
+#include <QObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// Not run by ctest: start it by hand to compare the save paths
+class KBookmarkBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void benchmarkSave_data();
+    void benchmarkSave();
+
+private:
+    QString m_fileName;
+    QString m_savedFileName;
+    KBookmarkManager *m_manager = nullptr;
+};
+
+void KBookmarkBenchmark::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    QDir().mkpath(dataDir);
+    m_fileName = dataDir + QStringLiteral("/benchmark.xbel");
+    m_savedFileName = dataDir + QStringLiteral("/benchmark-saved.xbel");
+    QFile::remove(m_fileName);
+
+    m_manager = KBookmarkManager::managerForExternalFile(m_fileName);
+    KBookmarkGroup root = m_manager->root();
+    for (int i = 0; i < 20; ++i) {
+        KBookmarkGroup folder = root.createNewFolder(QStringLiteral("Folder %1").arg(i));
+        QVector<KBookmarkGroup::NewBookmark> bookmarks;
+        for (int j = 0; j < 500; ++j) {
+            KBookmarkGroup::NewBookmark bookmark;
+            bookmark.text = QStringLiteral("Bookmark %1 \xe4\xf6\xfc & more").arg(j);
+            bookmark.url = QUrl(QStringLiteral("https://www.kde.org/%1/%2?q=x&y=z").arg(i).arg(j));
+            bookmark.icon = QStringLiteral("text-html");
+            bookmarks.append(bookmark);
+        }
+        folder.addBookmarks(bookmarks);
+    }
+}
+
+void KBookmarkBenchmark::cleanupTestCase()
+{
+    delete m_manager;
+    QFile::remove(m_fileName);
+    QFile::remove(m_savedFileName);
+    QFile::remove(m_savedFileName + QStringLiteral(".cache"));
+}
+
+void KBookmarkBenchmark::benchmarkSave_data()
+{
+    QTest::addColumn<bool>("streaming");
+    QTest::newRow("toString") << false;
+    QTest::newRow("saveAs") << true;
+}
+
+// The whole save, disk included: KBookmarkManager::saveAs() streams the
+// document and also writes the binary cache, QDomDocument::toString()
+// builds the whole file in one string first
+void KBookmarkBenchmark::benchmarkSave()
+{
+    QFETCH(bool, streaming);
+    const QDomDocument doc = m_manager->internalDocument();
+
+    QBENCHMARK {
+        if (streaming) {
+            QVERIFY(m_manager->saveAs(m_savedFileName, false));
+        } else {
+            QSaveFile file(m_savedFileName);
+            QVERIFY(file.open(QIODevice::WriteOnly));
+            file.write(doc.toString().toUtf8());
+            QVERIFY(file.commit());
+        }
+    }
+
+    QFile file(m_savedFileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QDomDocument written;
+    QVERIFY(written.setContent(&file));
+    QCOMPARE(written.documentElement().elementsByTagName(QStringLiteral("bookmark")).count(), 20 * 500);
+}
+
+QTEST_MAIN(KBookmarkBenchmark)
+
+#include "kbookmarkbenchmark.moc"
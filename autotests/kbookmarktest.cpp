@@ -20,11 +20,20 @@
 
 #include <kbookmark.h>
 #include <kbookmarkmanager.h>
+#include <kbookmarksnapshot.h>
 #include <QDebug>
 #include <QMimeData>
 #include <QStandardPaths>
+#include <QDBusMessage>
 #include <QDir>
+#include <QFileInfo>
 #include <QObject>
+#include <QSignalSpy>
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <string.h>
 
 class KBookmarkTest : public QObject
 {
@@ -36,6 +45,32 @@ private Q_SLOTS:
     void testMimeDataBookmarkList();
     void testFileCreatedExternally();
     void testBookmarkManager();
+    void testParseRoundTrip();
+    void testParseTrailingGarbage();
+    void testAddressAfterStructureChanges();
+    void testFindByUrl();
+    void testSaveDelay();
+    void testLazyLoading();
+    void testBinaryCache();
+    void testReparseDiff();
+    void testDelta();
+    void testDeltaAfterSave();
+    void testIconCache();
+    void testCachedFields();
+    void testMigration();
+    void testMetaDataItems();
+    void testAccessStatistics();
+    void testIds();
+    void testTransaction();
+    void testAddBookmarks();
+    void testIterators();
+    void testSnapshotMapReduce();
+    void testSnapshotSharing();
+    void testSkipUnchangedSave();
+    void testXbelWriterEscaping();
+    void testJournal();
+    void testBackups();
+    void testInternalElementEdit();
 };
 
 static const QString placesFile()
@@ -168,6 +203,1143 @@ void KBookmarkTest::testBookmarkManager()
     Q_UNUSED(manager);
 }
 
+void KBookmarkTest::testParseRoundTrip()
+{
+    const QString datadir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    const QString fileName = datadir + "/roundtrip.xbel";
+    const QString copyFileName = datadir + "/roundtrip-copy.xbel";
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<!DOCTYPE xbel>\n"
+               "<xbel xmlns:bookmark=\"http://www.freedesktop.org/standards/desktop-bookmarks\">\n"
+               " <!-- a comment -->\n"
+               " <folder folded=\"no\">\n"
+               "  <title>Folder</title>\n"
+               "  <bookmark href=\"http://www.kde.org\">\n"
+               "   <title>KDE\nWeb Site</title>\n"
+               "   <info><metadata owner=\"http://freedesktop.org\"><bookmark:icon name=\"kde\"/></metadata></info>\n"
+               "  </bookmark>\n"
+               "  <separator/>\n"
+               " </folder>\n"
+               "</xbel>\n");
+    file.close();
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmarkGroup folder = manager->root().first().toGroup();
+    QVERIFY(folder.isOpen());
+    QCOMPARE(folder.fullText(), QString("Folder"));
+    const KBookmark bookmark = folder.first();
+    QCOMPARE(bookmark.fullText(), QString("KDE Web Site"));
+    QCOMPARE(bookmark.icon(), QString("kde"));
+    QCOMPARE(bookmark.url(), QUrl("http://www.kde.org"));
+    QVERIFY(folder.next(bookmark).isSeparator());
+    QCOMPARE(bookmark.address(), QString("/0/0"));
+
+    QVERIFY(manager->saveAs(copyFileName, false));
+    KBookmarkManager *copy = KBookmarkManager::managerForExternalFile(copyFileName);
+    QCOMPARE(copy->internalDocument().toString(), manager->internalDocument().toString());
+
+    delete copy;
+    delete manager;
+    QFile::remove(fileName);
+    QFile::remove(copyFileName);
+}
+
+void KBookmarkTest::testParseTrailingGarbage()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/garbage.xbel";
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<xbel>\n"
+               " <bookmark href=\"http://www.kde.org\"><title>KDE &amp; co</title></bookmark>\n"
+               "</xbel>\n"
+               "trailing <garbage & junk");
+    file.close();
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmark bookmark = manager->root().first();
+    QCOMPARE(bookmark.url(), QUrl(QStringLiteral("http://www.kde.org")));
+    QCOMPARE(bookmark.fullText(), QStringLiteral("KDE & co"));
+    QVERIFY(manager->root().next(bookmark).isNull());
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testAddressAfterStructureChanges()
+{
+    KBookmarkManager *manager = KBookmarkManager::createTempManager();
+    KBookmarkGroup root = manager->root();
+    KBookmarkGroup folder = root.createNewFolder(QStringLiteral("Folder"));
+    const KBookmark first = folder.addBookmark(QStringLiteral("first"), QUrl(QStringLiteral("http://first")), QString());
+    const KBookmark second = folder.addBookmark(QStringLiteral("second"), QUrl(QStringLiteral("http://second")), QString());
+    const KBookmark third = folder.addBookmark(QStringLiteral("third"), QUrl(QStringLiteral("http://third")), QString());
+    QCOMPARE(third.address(), QString("/0/2"));
+    QCOMPARE(second.positionInParent(), 1);
+
+    folder.moveBookmark(third, KBookmark());
+    QCOMPARE(third.address(), QString("/0/0"));
+    QCOMPARE(first.address(), QString("/0/1"));
+
+    folder.deleteBookmark(first);
+    QCOMPARE(second.address(), QString("/0/1"));
+
+    KBookmarkGroup other = root.createNewFolder(QStringLiteral("Other"));
+    other.moveBookmark(second, KBookmark());
+    QCOMPARE(second.address(), QString("/1/0"));
+    QCOMPARE(folder.indexOf(second), -1);
+    QCOMPARE(manager->findByAddress(QStringLiteral("/1/0")).url(), QUrl(QStringLiteral("http://second")));
+    QCOMPARE(manager->findByAddress(QStringLiteral("/1/0+")).url(), QUrl(QStringLiteral("http://second")));
+    QVERIFY(manager->findByAddress(QStringLiteral("/1/1")).isNull());
+
+    // findByAddress caches its results, they must follow structural changes
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/0")).url(), QUrl(QStringLiteral("http://third")));
+    const KBookmark fourth = folder.addBookmark(QStringLiteral("fourth"), QUrl(QStringLiteral("http://fourth")), QString());
+    folder.moveBookmark(third, fourth);
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/0")).url(), QUrl(QStringLiteral("http://fourth")));
+
+    delete manager;
+}
+
+void KBookmarkTest::testFindByUrl()
+{
+    KBookmarkManager *manager = KBookmarkManager::createTempManager();
+    KBookmarkGroup root = manager->root();
+    const QUrl kde(QStringLiteral("http://www.kde.org/"));
+    const QUrl qt(QStringLiteral("http://www.qt.io/"));
+    KBookmarkGroup folder = root.createNewFolder(QStringLiteral("Folder"));
+    KBookmark first = folder.addBookmark(QStringLiteral("KDE"), kde, QString());
+    QVERIFY(manager->isBookmarked(kde));
+    QVERIFY(!manager->isBookmarked(qt));
+
+    // Once the index exists, it has to follow changes
+    const KBookmark second = root.addBookmark(QStringLiteral("KDE again"), kde, QString());
+    QCOMPARE(manager->findByUrl(kde).count(), 2);
+    first.setUrl(qt);
+    QCOMPARE(manager->findByUrl(kde).count(), 1);
+    QCOMPARE(manager->findByUrl(qt).count(), 1);
+    root.deleteBookmark(folder);
+    QVERIFY(!manager->isBookmarked(qt));
+    QCOMPARE(manager->findByUrl(kde).first().text(), QStringLiteral("KDE again"));
+    QVERIFY(manager->updateAccessMetadata(kde.toString()));
+    QCOMPARE(second.metaDataItem(QStringLiteral("visit_count")), QStringLiteral("1"));
+
+    delete manager;
+}
+
+void KBookmarkTest::testSaveDelay()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/savedelay.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    manager->setSaveDelay(50);
+    QSignalSpy spy(manager, &KBookmarkManager::saveFinished);
+    KBookmarkGroup root = manager->root();
+    for (int i = 0; i < 3; ++i) {
+        root.addBookmark(QString::number(i), QUrl(QStringLiteral("http://www.kde.org/%1").arg(i)), QString());
+        manager->emitChanged(root);
+    }
+    QVERIFY(!QFile::exists(fileName));
+    QVERIFY(spy.wait());
+    QCOMPARE(spy.count(), 1); // all three changes in one write
+    QVERIFY(spy.at(0).at(0).toBool());
+    QVERIFY(QFile::exists(fileName));
+
+    root.addBookmark(QStringLiteral("3"), QUrl(QStringLiteral("http://www.kde.org/3")), QString());
+    manager->emitChanged(root);
+    QVERIFY(manager->flush());
+    QCOMPARE(spy.count(), 2);
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QDomDocument doc;
+    QVERIFY(doc.setContent(&file));
+    QCOMPARE(doc.documentElement().elementsByTagName(QStringLiteral("bookmark")).count(), 4);
+
+    // The delayed write also broadcasts the id of the group
+    KBookmarkGroup folder = root.createNewFolder(QStringLiteral("folder"));
+    manager->emitChanged(root);
+    QVERIFY(manager->flush());
+    QSignalSpy idSpy(manager, &KBookmarkManager::bookmarksChangedWithId);
+    folder.addBookmark(QStringLiteral("4"), QUrl(QStringLiteral("http://www.kde.org/4")), QString());
+    manager->emitChanged(folder);
+    QVERIFY(idSpy.isEmpty());
+    QVERIFY(spy.wait());
+    QCOMPARE(idSpy.count(), 1);
+    QCOMPARE(idSpy.at(0).at(0).toString(), folder.address());
+    QVERIFY(!folder.id().isEmpty());
+    QCOMPARE(idSpy.at(0).at(1).toString(), folder.id());
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testLazyLoading()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/lazy.xbel";
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<xbel>\n"
+               " <folder>\n"
+               "  <title>Outer</title>\n"
+               "  <bookmark href=\"http://outer\"><title>outer</title></bookmark>\n"
+               "  <folder toolbar=\"yes\">\n"
+               "   <title>Toolbar</title>\n"
+               "   <bookmark href=\"http://inner\"><title>inner</title></bookmark>\n"
+               "  </folder>\n"
+               "  <separator/>\n"
+               " </folder>\n"
+               " <folder><title>Other</title><bookmark href=\"http://other\"><title>other</title></bookmark></folder>\n"
+               " <bookmark href=\"http://toplevel\"><title>toplevel</title></bookmark>\n"
+               "</xbel>\n");
+    file.close();
+
+    KBookmarkManager *eager = KBookmarkManager::managerForExternalFile(fileName);
+    const QString expected = eager->internalDocument().toString();
+    delete eager;
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    manager->setLazyLoadingEnabled(true);
+    const KBookmarkGroup outer = manager->root().first().toGroup();
+    QCOMPARE(outer.fullText(), QStringLiteral("Outer"));
+    QCOMPARE(manager->toolbar().fullText(), QStringLiteral("Toolbar"));
+    QCOMPARE(manager->toolbar().first().url(), QUrl(QStringLiteral("http://inner")));
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/2")).isSeparator(), true);
+
+    // Adding to a folder which wasn't loaded yet keeps its bookmarks first
+    KBookmarkGroup other = manager->root().next(outer).toGroup();
+    other.addBookmark(QStringLiteral("new"), QUrl(QStringLiteral("http://new")), QString());
+    QCOMPARE(other.first().url(), QUrl(QStringLiteral("http://other")));
+    other.deleteBookmark(other.next(other.first()));
+
+    QVERIFY(manager->isBookmarked(QUrl(QStringLiteral("http://other"))));
+    QCOMPARE(manager->internalDocument().toString(), expected);
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+static void writeBookmarkFile(const QString &fileName, const QByteArray &url)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<xbel>\n"
+               " <folder><title>Folder</title><bookmark href=\"" + url + "\"><title>\xc3\xa9t\xc3\xa9</title></bookmark></folder>\n"
+               "</xbel>\n");
+}
+
+// Points the first child of the root node to itself, see KBookmarkTree::Node
+static bool makeCacheLoop(const QString &cacheFileName)
+{
+    QFile file(cacheFileName);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    const QByteArray header = file.read(64);
+    quint32 nodeCount;
+    quint32 attributeCount;
+    memcpy(&nodeCount, header.constData() + 52, sizeof(nodeCount));
+    memcpy(&attributeCount, header.constData() + 56, sizeof(attributeCount));
+    const qint64 nodesOffset = file.size() - qint64(attributeCount) * 8 - qint64(nodeCount) * 36;
+    const qint32 self = 0;
+    return file.seek(nodesOffset + 4) && file.write(reinterpret_cast<const char *>(&self), sizeof(self)) == sizeof(self);
+}
+
+void KBookmarkTest::testBinaryCache()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/cached.xbel";
+    const QString cacheFileName = fileName + ".cache";
+    QFile::remove(cacheFileName);
+    writeBookmarkFile(fileName, "http://first");
+
+    // Without a cache, loading doesn't hash the file and the first save creates the cache
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    QVERIFY(!QFile::exists(cacheFileName));
+    QVERIFY(manager->saveAs(fileName));
+    const QString parsed = manager->internalDocument().toString();
+    delete manager;
+    QVERIFY(QFile::exists(cacheFileName));
+
+    // Loaded from the cache
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    QCOMPARE(manager->internalDocument().toString(), parsed);
+    QCOMPARE(manager->root().first().toGroup().first().fullText(), QString::fromUtf8("\xc3\xa9t\xc3\xa9"));
+    delete manager;
+
+    // A cache whose root element is its own first child is ignored instead of looping
+    QVERIFY(makeCacheLoop(cacheFileName));
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    QCOMPARE(manager->internalDocument().toString(), parsed);
+    delete manager;
+
+    // The file changed behind the cache's back (same size)
+    writeBookmarkFile(fileName, "http://other");
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    QCOMPARE(manager->root().first().toGroup().first().url(), QUrl(QStringLiteral("http://other")));
+    delete manager;
+
+    QFile::remove(fileName);
+    QFile::remove(cacheFileName);
+}
+
+static void writeTwoFolders(const QString &fileName, const QByteArray &secondUrl)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<xbel>\n"
+               " <folder><title>First</title><bookmark href=\"http://first\"><title>first</title></bookmark>"
+               "<folder><title>Sub</title><bookmark href=\"" + secondUrl + "\"><title>second</title></bookmark></folder></folder>\n"
+               " <folder><title>Third</title><bookmark href=\"http://third\"><title>third</title></bookmark></folder>\n"
+               "</xbel>\n");
+}
+
+void KBookmarkTest::testReparseDiff()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/reparse.xbel";
+    writeTwoFolders(fileName, "http://second");
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmark first = manager->root().first().toGroup().first();
+    const KBookmark third = manager->findByAddress(QStringLiteral("/1/0"));
+    QCOMPARE(third.url(), QUrl(QStringLiteral("http://third")));
+    QVERIFY(manager->isBookmarked(QUrl(QStringLiteral("http://second"))));
+
+    QSignalSpy spy(manager, &KBookmarkManager::changed);
+    writeTwoFolders(fileName, "http://changed");
+    manager->notifyCompleteChange(QString());
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QStringLiteral("/0/1"));
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/1/0")).url(), QUrl(QStringLiteral("http://changed")));
+    QVERIFY(manager->findByUrl(QUrl(QStringLiteral("http://changed"))).count() == 1);
+    QVERIFY(!manager->isBookmarked(QUrl(QStringLiteral("http://second"))));
+
+    // Unchanged bookmarks are still the same elements
+    QVERIFY(manager->root().first().toGroup().first() == first);
+    QVERIFY(manager->findByAddress(QStringLiteral("/1/0")) == third);
+
+    // Nothing changed, nothing to refresh
+    spy.clear();
+    manager->notifyCompleteChange(QString());
+    QCOMPARE(spy.count(), 0);
+
+    delete manager;
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".cache");
+}
+
+void KBookmarkTest::testDelta()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/delta.xbel";
+    writeTwoFolders(fileName, "http://second");
+    // Only managers shared over D-Bus broadcast their changes
+    KBookmarkManager *manager = KBookmarkManager::managerForFile(fileName, QStringLiteral("kbookmarktest-delta"));
+    QSignalSpy spy(manager, &KBookmarkManager::bookmarksDelta);
+
+    KBookmarkGroup root = manager->root();
+    KBookmarkGroup folder = root.first().toGroup();
+    folder.addBookmark(QStringLiteral("new"), QUrl(QStringLiteral("http://new")), QString());
+    root.moveBookmark(root.next(folder), KBookmark());
+    manager->emitChanged(root);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toULongLong(), Q_UINT64_C(0));
+    QCOMPARE(spy.at(0).at(1).toULongLong(), Q_UINT64_C(1));
+    QVERIFY(!spy.at(0).at(2).toByteArray().isEmpty());
+
+    // Direct DOM changes can't be described, the other processes have to reparse
+    spy.clear();
+    root.first().internalElement().setAttribute(QStringLiteral("folded"), QStringLiteral("yes"));
+    root.first().setFullText(QStringLiteral("Renamed"));
+    manager->emitChanged(root);
+    QCOMPARE(spy.count(), 0);
+    QCOMPARE(manager->root().internalElement().attribute(QStringLiteral("revision")), QStringLiteral("2"));
+
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testDeltaAfterSave()
+{
+    const QString dataDir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+    const QString fileName = dataDir + "/deltasave.xbel";
+    const QString peerFileName = dataDir + "/deltasave-peer.xbel";
+    writeTwoFolders(fileName, "http://second");
+    writeTwoFolders(peerFileName, "http://second");
+    KBookmarkManager *manager = KBookmarkManager::managerForFile(fileName, QStringLiteral("kbookmarktest-deltasave"));
+    KBookmarkManager *peer = KBookmarkManager::managerForFile(peerFileName, QStringLiteral("kbookmarktest-deltasave-peer"));
+    (void) peer->root();
+    QSignalSpy spy(manager, &KBookmarkManager::bookmarksDelta);
+
+    // Saved without being broadcast, then a change whose address depends on it
+    KBookmarkGroup root = manager->root();
+    const KBookmark saved = root.addBookmark(QStringLiteral("saved"), QUrl(QStringLiteral("http://saved")), QString());
+    root.moveBookmark(saved, KBookmark());
+    QVERIFY(manager->save());
+    root.deleteBookmark(root.next(saved)); // the first folder, /1 now
+    manager->emitChanged(root);
+
+    // Whatever is broadcast brings the peer to the same bookmarks
+    const QDBusMessage msg = QDBusMessage::createSignal(QStringLiteral("/KBookmarkManager/kbookmarktest-deltasave"),
+                                                        QStringLiteral("org.kde.KIO.KBookmarkManager"), QStringLiteral("bookmarksDelta"));
+    for (int i = 0; i < spy.count(); ++i) {
+        const QList<QVariant> args = spy.at(i);
+        QVERIFY(QMetaObject::invokeMethod(peer, "notifyDelta", Qt::DirectConnection,
+                                          Q_ARG(qulonglong, args.at(0).toULongLong()), Q_ARG(qulonglong, args.at(1).toULongLong()),
+                                          Q_ARG(QByteArray, args.at(2).toByteArray()), Q_ARG(QDBusMessage, msg)));
+    }
+    QVERIFY(spy.isEmpty()); // the saved change was never broadcast, the peer has to reparse
+    // Not the third folder deleted instead, at /1 in the peer's version
+    QVERIFY(peer->isBookmarked(QUrl(QStringLiteral("http://third"))));
+
+    QFile::remove(fileName);
+    QFile::remove(peerFileName);
+}
+
+void KBookmarkTest::testIconCache()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/icons.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    const KBookmark first = root.addBookmark(QStringLiteral("first"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    const KBookmark second = root.addBookmark(QStringLiteral("second"), QUrl(QStringLiteral("http://www.kde.org/other")), QString());
+    KBookmark explicitIcon = root.addBookmark(QStringLiteral("third"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    explicitIcon.setIcon(QStringLiteral("konqueror"));
+
+    const QString icon = first.icon();
+    QCOMPARE(manager->iconCacheMisses(), 1);
+    QCOMPARE(second.icon(), icon);
+    QCOMPARE(manager->iconCacheHits(), 1);
+    QCOMPARE(explicitIcon.icon(), QStringLiteral("konqueror"));
+    QCOMPARE(manager->iconCacheHits() + manager->iconCacheMisses(), 2);
+
+    // The mime type set explicitly is looked up instead
+    KBookmark withMimeType = second;
+    withMimeType.setMimeType(QStringLiteral("inode/directory"));
+    QCOMPARE(withMimeType.icon(), QStringLiteral("inode-directory"));
+    QCOMPARE(manager->iconCacheMisses(), 2);
+
+    delete manager;
+}
+
+void KBookmarkTest::testCachedFields()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/fields.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmark bookmark = manager->root().addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    QCOMPARE(bookmark.url(), QUrl(QStringLiteral("http://www.kde.org")));
+    QCOMPARE(bookmark.text(), QStringLiteral("KDE"));
+
+    bookmark.setUrl(QUrl(QStringLiteral("http://www.kde.org/other")));
+    bookmark.setFullText(QStringLiteral("Other"));
+    QCOMPARE(bookmark.url(), QUrl(QStringLiteral("http://www.kde.org/other")));
+    QCOMPARE(bookmark.text(), QStringLiteral("Other"));
+
+    // Changes behind the back of the KBookmark API, reported by emitChanged()
+    bookmark.internalElement().setAttribute(QStringLiteral("href"), QStringLiteral("http://changed"));
+    manager->emitChanged();
+    QCOMPARE(bookmark.url(), QUrl(QStringLiteral("http://changed")));
+
+    delete manager;
+}
+
+void KBookmarkTest::testMigration()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/migration.xbel";
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<xbel>\n"
+               " <bookmark href=\"http://www.kde.org\" icon=\"www\" showintoolbar=\"yes\"><title>KDE</title>"
+               "<info><metadata><time_added>1</time_added></metadata></info></bookmark>\n"
+               "</xbel>\n");
+    file.close();
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmark bookmark = manager->root().first();
+    QCOMPARE(bookmark.icon(), QStringLiteral("internet-web-browser"));
+    QVERIFY(bookmark.showInToolbar());
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("time_added")), QStringLiteral("1"));
+
+    const QDomElement element = bookmark.internalElement();
+    QVERIFY(!element.hasAttribute(QStringLiteral("icon")));
+    QVERIFY(!element.hasAttribute(QStringLiteral("showintoolbar")));
+    QCOMPARE(element.firstChildElement(QStringLiteral("info")).firstChildElement(QStringLiteral("metadata")).attribute(QStringLiteral("owner")),
+             QStringLiteral("http://www.kde.org"));
+    QVERIFY(manager->root().internalElement().hasAttribute(QStringLiteral("schemaVersion")));
+
+    delete manager;
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".cache");
+}
+
+void KBookmarkTest::testMetaDataItems()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/metadata.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmark bookmark = manager->root().addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")), QStringLiteral("kde"));
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("visit_count")), QString());
+    bookmark.updateAccessMetadata();
+    bookmark.updateAccessMetadata();
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("visit_count")), QStringLiteral("2"));
+    bookmark.setMetaDataItem(QStringLiteral("visit_count"), QStringLiteral("5"), KBookmark::DontOverwriteMetaData);
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("visit_count")), QStringLiteral("2"));
+    QCOMPARE(bookmark.icon(), QStringLiteral("kde"));
+
+    bookmark.setMetaDataItem(QStringLiteral("note"), QStringLiteral("1"));
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("note")), QStringLiteral("1"));
+
+    // Reading the metadata doesn't count as a change
+    const quint64 generation = manager->generation();
+    QCOMPARE(bookmark.metaData(QStringLiteral("http://www.kde.org"), false).firstChildElement(QStringLiteral("note")).text(), QStringLiteral("1"));
+    QVERIFY(bookmark.metaData(QStringLiteral("http://example.org"), false).isNull());
+    QCOMPARE(manager->generation(), generation);
+
+    // Changes through the DOM are seen
+    bookmark.metaData(QStringLiteral("http://www.kde.org"), true).firstChildElement(QStringLiteral("note")).firstChild().setNodeValue(QStringLiteral("7"));
+    manager->emitChanged();
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("note")), QStringLiteral("7"));
+
+    delete manager;
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".stats");
+}
+
+void KBookmarkTest::testAccessStatistics()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/stats.xbel";
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".stats");
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmark bookmark = manager->root().addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")));
+    QVERIFY(manager->save());
+
+    QVERIFY(manager->updateAccessMetadata(QStringLiteral("http://www.kde.org")));
+    QVERIFY(manager->updateAccessMetadata(QStringLiteral("http://www.kde.org")));
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("visit_count")), QStringLiteral("2"));
+    QVERIFY(!bookmark.metaDataItem(QStringLiteral("time_visited")).isEmpty());
+
+    // Kept out of the bookmark file
+    QVERIFY(QFile::exists(fileName + ".stats"));
+    const QDomElement metadata = bookmark.internalElement().firstChildElement(QStringLiteral("info")).firstChildElement(QStringLiteral("metadata"));
+    QVERIFY(metadata.firstChildElement(QStringLiteral("visit_count")).isNull());
+
+    QVERIFY(manager->compactAccessStatistics());
+    QVERIFY(!QFile::exists(fileName + ".stats"));
+    bookmark = manager->root().first();
+    QCOMPARE(bookmark.metaDataItem(QStringLiteral("visit_count")), QStringLiteral("2"));
+    const QDomElement compacted = bookmark.internalElement().firstChildElement(QStringLiteral("info")).firstChildElement(QStringLiteral("metadata"));
+    QCOMPARE(compacted.firstChildElement(QStringLiteral("visit_count")).text(), QStringLiteral("2"));
+    delete manager;
+
+    // Bookmarks without an id keep their statistics in the XBEL metadata, and don't get one
+    writeBookmarkFile(fileName, "http://www.kde.org");
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    QVERIFY(manager->updateAccessMetadata(QStringLiteral("http://www.kde.org")));
+    QVERIFY(!QFile::exists(fileName + ".stats"));
+    bookmark = manager->root().first().toGroup().first();
+    QVERIFY(bookmark.id().isEmpty());
+    const QDomElement xbelMetadata = bookmark.internalElement().firstChildElement(QStringLiteral("info")).firstChildElement(QStringLiteral("metadata"));
+    QCOMPARE(xbelMetadata.firstChildElement(QStringLiteral("visit_count")).text(), QStringLiteral("1"));
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testIds()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/ids.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    KBookmarkGroup folder = root.createNewFolder(QStringLiteral("folder"));
+    KBookmark kde = folder.addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")));
+    QVERIFY(root.id().isEmpty());
+    const QString id = kde.id();
+    QVERIFY(!id.isEmpty());
+    QCOMPARE(kde.id(), id);
+    QVERIFY(folder.id() != id);
+    QCOMPARE(manager->findById(id), kde);
+    QCOMPARE(manager->findById(folder.id()), KBookmark(folder));
+
+    // Stays valid when the addresses change
+    KBookmark qt = folder.addBookmark(QStringLiteral("Qt"), QUrl(QStringLiteral("http://www.qt.io")));
+    folder.moveBookmark(qt, KBookmark());
+    QCOMPARE(kde.address(), QStringLiteral("/0/1"));
+    QCOMPARE(manager->findById(id).address(), QStringLiteral("/0/1"));
+
+    // Copies get their own
+    const KBookmark copy = root.addBookmark(KBookmark(kde.internalElement().cloneNode(true).toElement()));
+    QVERIFY(!copy.id().isEmpty());
+    QVERIFY(copy.id() != id);
+    QCOMPARE(manager->findById(id), kde);
+    QCOMPARE(manager->findById(copy.id()), copy);
+
+    // Saved in the file
+    QVERIFY(manager->save());
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(file.readAll().contains(id.toUtf8()));
+
+    folder.deleteBookmark(kde);
+    QVERIFY(manager->findById(id).isNull());
+
+    delete manager;
+    QFile::remove(fileName);
+
+    // Bookmarks written by other programs only get one when asked for
+    writeBookmarkFile(fileName, "http://www.kde.org");
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmark other = manager->root().first().toGroup().first();
+    const quint64 generation = manager->generation();
+    QVERIFY(other.id().isEmpty());
+    QCOMPARE(manager->generation(), generation);
+    const QString otherId = other.ensureId();
+    QVERIFY(!otherId.isEmpty());
+    QCOMPARE(other.id(), otherId);
+    QCOMPARE(manager->findById(otherId), other);
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testTransaction()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/transaction.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    manager->root().createNewFolder(QStringLiteral("folder"));
+    manager->emitChanged();
+    QSignalSpy spy(manager, SIGNAL(bookmarksChanged(QString)));
+
+    manager->beginTransaction();
+    KBookmarkGroup folder = manager->root().first().toGroup();
+    for (int i = 0; i < 3; ++i) {
+        folder.addBookmark(QString::number(i), QUrl(QStringLiteral("http://www.kde.org/") + QString::number(i)));
+        manager->emitChanged(folder);
+    }
+    manager->beginTransaction();
+    manager->emitChanged(folder);
+    QVERIFY(manager->commitTransaction());
+    QCOMPARE(spy.count(), 0);
+    QVERIFY(manager->commitTransaction());
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QStringLiteral("/0"));
+    QVERIFY(!manager->commitTransaction());
+
+    manager->beginTransaction();
+    folder = manager->root().first().toGroup();
+    folder.deleteBookmark(folder.first());
+    manager->root().addBookmark(QStringLiteral("Qt"), QUrl(QStringLiteral("http://www.qt.io")));
+    manager->emitChanged();
+    manager->rollbackTransaction();
+    QCOMPARE(spy.count(), 1);
+    QVERIFY(manager->root().next(manager->root().first()).isNull());
+    folder = manager->root().first().toGroup();
+    QCOMPARE(folder.first().text(), QStringLiteral("0"));
+    QCOMPARE(manager->findByUrl(QUrl(QStringLiteral("http://www.qt.io"))).count(), 0);
+
+    // A later change moving the changed group doesn't make the commit save the wrong one
+    for (int i = 1; i < 4; ++i) {
+        manager->root().createNewFolder(QStringLiteral("folder") + QString::number(i));
+    }
+    manager->emitChanged();
+    spy.clear();
+    manager->beginTransaction();
+    KBookmarkGroup third = manager->findByAddress(QStringLiteral("/3")).toGroup();
+    third.addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")));
+    manager->emitChanged(third);
+    manager->root().deleteBookmark(manager->findByAddress(QStringLiteral("/1")));
+    QVERIFY(manager->commitTransaction());
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QStringLiteral("/2"));
+
+    // The changed group was deleted afterwards
+    spy.clear();
+    manager->beginTransaction();
+    third = manager->findByAddress(QStringLiteral("/2")).toGroup();
+    third.addBookmark(QStringLiteral("Qt"), QUrl(QStringLiteral("http://www.qt.io")));
+    manager->emitChanged(third);
+    manager->root().deleteBookmark(third);
+    QVERIFY(manager->commitTransaction());
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).toString(), QString());
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testAddBookmarks()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/bulk.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    root.addBookmark(QStringLiteral("first"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+
+    QVector<KBookmarkGroup::NewBookmark> bookmarks;
+    for (int i = 0; i < 100; ++i) {
+        KBookmarkGroup::NewBookmark bookmark;
+        bookmark.text = QString::number(i);
+        bookmark.url = QUrl(QStringLiteral("http://www.kde.org/%1 page").arg(i));
+        bookmark.icon = QStringLiteral("kde");
+        bookmarks.append(bookmark);
+    }
+    const KBookmark::List added = root.addBookmarks(bookmarks);
+    QCOMPARE(added.count(), 100);
+    QCOMPARE(added.at(42).address(), QStringLiteral("/43"));
+    QCOMPARE(added.at(42).text(), QStringLiteral("42"));
+    QCOMPARE(added.at(42).icon(), QStringLiteral("kde"));
+    QCOMPARE(added.at(42).url(), bookmarks.at(42).url);
+    QCOMPARE(root.next(added.at(42)), added.at(43));
+    QCOMPARE(manager->findByUrl(bookmarks.at(99).url).count(), 1);
+
+    // The same as added one by one, except for the id
+    const KBookmark single = root.addBookmark(QStringLiteral("42"), bookmarks.at(42).url, QStringLiteral("kde"));
+    QVERIFY(!added.at(42).id().isEmpty());
+    QVERIFY(added.at(42).id() != single.id());
+    QDomDocument doc;
+    doc.appendChild(doc.importNode(single.internalElement(), true));
+    doc.documentElement().removeAttribute(QStringLiteral("id"));
+    QDomDocument bulkDoc;
+    bulkDoc.appendChild(bulkDoc.importNode(added.at(42).internalElement(), true));
+    bulkDoc.documentElement().removeAttribute(QStringLiteral("id"));
+    QCOMPARE(bulkDoc.toString(), doc.toString());
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+static QStringList texts(const KBookmarkGroup &group)
+{
+    QStringList result;
+    for (KBookmarkDescendantIterator it = group.descendants().begin(); it != group.descendants().end(); ++it) {
+        result.append(QString(it.depth(), QLatin1Char('-')) + ((*it).isSeparator() ? QStringLiteral("|") : (*it).text()));
+    }
+    return result;
+}
+
+void KBookmarkTest::testIterators()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/iterators.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    KBookmarkGroup a = root.createNewFolder(QStringLiteral("A"));
+    a.addBookmark(QStringLiteral("a1"), QUrl(QStringLiteral("http://a1")), QString());
+    a.createNewSeparator();
+    KBookmarkGroup b = a.createNewFolder(QStringLiteral("B"));
+    b.addBookmark(QStringLiteral("b1"), QUrl(QStringLiteral("http://b1")), QString());
+    a.createNewFolder(QStringLiteral("C"));
+    root.addBookmark(QStringLiteral("r1"), QUrl(QStringLiteral("http://r1")), QString());
+
+    QCOMPARE(int(std::distance(a.children().begin(), a.children().end())), 4);
+    QCOMPARE(int(std::distance(a.folders().begin(), a.folders().end())), 2);
+    QCOMPARE((*a.bookmarks().begin()).text(), QStringLiteral("a1"));
+    QCOMPARE(int(std::distance(b.folders().begin(), b.folders().end())), 0);
+
+    KBookmarkChildIterator last = a.children().end();
+    --last;
+    QCOMPARE((*last).text(), QStringLiteral("C"));
+    QCOMPARE((*--last).text(), QStringLiteral("B"));
+    QVERIFY((*--last).isSeparator());
+    KBookmarkChildIterator lastFolder = a.folders().end();
+    QCOMPARE((*--lastFolder).text(), QStringLiteral("C"));
+
+    const KBookmarkChildRange children = root.children();
+    QVERIFY(std::find(children.begin(), children.end(), KBookmark(b)) == children.end());
+    QVERIFY(std::find(children.begin(), children.end(), KBookmark(a)) == children.begin());
+
+    const QStringList expected = QStringList() << QStringLiteral("A") << QStringLiteral("-a1") << QStringLiteral("-|")
+                                 << QStringLiteral("-B") << QStringLiteral("--b1") << QStringLiteral("-C") << QStringLiteral("r1");
+    QCOMPARE(texts(root), expected);
+
+    // Without an index
+    QDomDocument doc;
+    doc.appendChild(doc.importNode(root.internalElement(), true));
+    QCOMPARE(texts(KBookmarkGroup(doc.documentElement())), expected);
+    KBookmarkGroup copy(doc.documentElement().firstChildElement(QStringLiteral("folder")));
+    KBookmarkChildIterator copyLast = copy.children().end();
+    QCOMPARE((*--copyLast).text(), QStringLiteral("C"));
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testSnapshotMapReduce()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/snapshot.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    QStringList expected;
+    for (int i = 0; i < 20; ++i) {
+        KBookmarkGroup folder = root.createNewFolder(QStringLiteral("folder %1").arg(i));
+        expected.append(folder.fullText());
+        QVector<KBookmarkGroup::NewBookmark> bookmarks;
+        for (int j = 0; j < i * 20; ++j) {
+            KBookmarkGroup::NewBookmark bookmark;
+            bookmark.text = QStringLiteral("%1/%2").arg(i).arg(j);
+            bookmark.url = QUrl(QStringLiteral("http://www.kde.org/%1").arg(j));
+            bookmarks.append(bookmark);
+            expected.append(bookmark.text);
+        }
+        folder.addBookmarks(bookmarks);
+        if (i % 3 == 0) {
+            folder.createNewSeparator();
+            expected.append(QString());
+        }
+    }
+
+    const KBookmarkSnapshot snapshot(root);
+    QCOMPARE(snapshot.descendantCount(), expected.count());
+    QThreadPool pool;
+    pool.setMaxThreadCount(4);
+    const QStringList texts = snapshot.mapReduce<QStringList>([](const KBookmarkSnapshot &node) {
+        return QStringList(node.text());
+    }, [](const QStringList &a, const QStringList &b) {
+        return a + b;
+    }, QStringList(), &pool);
+    QCOMPARE(texts, expected);
+    const int bookmarkCount = snapshot.mapReduce<int>([](const KBookmarkSnapshot &node) {
+        return node.type() == KBookmarkSnapshot::Bookmark ? 1 : 0;
+    }, [](int a, int b) {
+        return a + b;
+    });
+    QCOMPARE(bookmarkCount, 20 * 19 * 10);
+
+    // Not affected by changes
+    root.deleteBookmark(root.first());
+    QCOMPARE(snapshot.childCount(), 20);
+    QCOMPARE(snapshot.child(0).text(), QStringLiteral("folder 0"));
+
+    // Taken from the parsed file before the DOM exists, same result
+    manager->emitChanged();
+    delete manager;
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    const auto allTexts = [](const KBookmarkSnapshot &snapshot) {
+        return snapshot.mapReduce<QStringList>([](const KBookmarkSnapshot &node) {
+            return QStringList(node.text() + QLatin1Char(' ') + node.url().toString() + QLatin1Char(' ') + node.id());
+        }, [](const QStringList &a, const QStringList &b) {
+            return a + b;
+        });
+    };
+    const KBookmarkSnapshot fromTree = manager->snapshot();
+    const KBookmarkSnapshot fromDom(manager->root());
+    QCOMPARE(fromTree.descendantCount(), fromDom.descendantCount());
+    QCOMPARE(fromTree.child(1).child(3).url(), QUrl(QStringLiteral("http://www.kde.org/3")));
+    QCOMPARE(allTexts(fromTree), allTexts(fromDom));
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testSnapshotSharing()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/sharing.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup root = manager->root();
+    KBookmarkGroup a = root.createNewFolder(QStringLiteral("A"));
+    KBookmark a1 = a.addBookmark(QStringLiteral("a1"), QUrl(QStringLiteral("http://a1")), QString());
+    KBookmarkGroup b = root.createNewFolder(QStringLiteral("B"));
+    b.addBookmark(QStringLiteral("b1"), QUrl(QStringLiteral("http://b1")), QString());
+
+    const KBookmarkSnapshot first = manager->snapshot();
+    QVERIFY(manager->snapshot().isSharedWith(first));
+
+    a1.setFullText(QStringLiteral("changed"));
+    const KBookmarkSnapshot second = manager->snapshot();
+    QVERIFY(!second.isSharedWith(first));
+    QVERIFY(!second.child(0).isSharedWith(first.child(0)));
+    QVERIFY(second.child(1).isSharedWith(first.child(1)));
+    QCOMPARE(first.child(0).child(0).text(), QStringLiteral("a1"));
+    QCOMPARE(second.child(0).child(0).text(), QStringLiteral("changed"));
+
+    // Moved folders are shared too
+    root.moveBookmark(b, KBookmark());
+    const KBookmarkSnapshot third = manager->snapshot();
+    QVERIFY(third.child(0).isSharedWith(second.child(1)));
+    QVERIFY(third.child(1).isSharedWith(second.child(0)));
+
+    root.deleteBookmark(a);
+    QCOMPARE(manager->snapshot().childCount(), 1);
+    QCOMPARE(third.childCount(), 2);
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testSkipUnchangedSave()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/unchanged.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmark bookmark = manager->root().addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    manager->emitChanged();
+    QVERIFY(QFile::exists(fileName));
+
+    // Mark the file to see whether it gets written
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::Append));
+    file.write("<!-- marker -->\n");
+    file.close();
+    const auto containsMarker = [&file]() {
+        return file.open(QIODevice::ReadOnly) && file.readAll().contains("marker");
+    };
+
+    const quint64 generation = manager->generation();
+    QCOMPARE(bookmark.text(), QStringLiteral("KDE"));
+    (void) manager->findByUrl(QUrl(QStringLiteral("http://www.kde.org")));
+    QCOMPARE(manager->generation(), generation);
+    QVERIFY(manager->save());
+    manager->emitChanged();
+    QVERIFY(containsMarker());
+    file.close();
+
+    bookmark.setFullText(QStringLiteral("changed"));
+    QVERIFY(manager->generation() > generation);
+    QVERIFY(manager->save());
+    QVERIFY(!containsMarker());
+    file.close();
+    delete manager;
+
+    // Broadcasting a folder which has no id yet doesn't give it one, which would need a write
+    writeBookmarkFile(fileName, "http://www.kde.org");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const QByteArray contents = file.readAll();
+    file.close();
+    const QDateTime modified = QFileInfo(fileName).lastModified();
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmarkGroup folder = manager->root().first().toGroup();
+    QSignalSpy idSpy(manager, &KBookmarkManager::bookmarksChangedWithId);
+    manager->emitChanged(folder);
+    QCOMPARE(idSpy.count(), 1);
+    QVERIFY(idSpy.at(0).at(1).toString().isEmpty());
+    QVERIFY(folder.id().isEmpty());
+    QCOMPARE(QFileInfo(fileName).lastModified(), modified);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), contents);
+    file.close();
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testXbelWriterEscaping()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/escaping.xbel";
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".cache");
+    const QString text = QStringLiteral("<a> & \"b\" ]]> \xfc\x20ac ") + QString::fromUcs4(U"\U0001F516");
+    const QString attribute = QStringLiteral("line\nnext\tline \"quoted\" & <tag>");
+    const QUrl url(QStringLiteral("http://www.kde.org/?a=1&b=2"));
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup folder = manager->root().createNewFolder(QStringLiteral("folder"));
+    KBookmark bookmark = folder.addBookmark(text, url, QString());
+    bookmark.setDescription(text);
+    bookmark.internalElement().setAttribute(QStringLiteral("test"), attribute);
+    // Read back as a single text node
+    QDomElement desc = bookmark.internalElement().firstChildElement(QStringLiteral("desc"));
+    desc.appendChild(desc.ownerDocument().createCDATASection(QStringLiteral("<cdata>")));
+    manager->emitChanged(folder);
+    QVERIFY(manager->saveAs(fileName, false));
+    delete manager;
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QDomDocument doc;
+    QVERIFY(doc.setContent(&file));
+    file.close();
+    const QDomElement element = doc.documentElement().firstChildElement(QStringLiteral("folder"))
+                                .firstChildElement(QStringLiteral("bookmark"));
+    QCOMPARE(element.attribute(QStringLiteral("test")), attribute);
+    QCOMPARE(element.attribute(QStringLiteral("href")), url.toString());
+    const KBookmark reread(element);
+    QCOMPARE(reread.text(), text);
+    QCOMPARE(reread.description(), text + QStringLiteral("<cdata>"));
+
+    // The cache written along with the file holds the same as the file
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    const QString cached = manager->internalDocument().toString();
+    delete manager;
+    QVERIFY(QFile::remove(fileName + ".cache"));
+
+    // Loaded through KBookmarkXbelReader this time
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    const KBookmark loaded = manager->root().first().toGroup().first();
+    QCOMPARE(loaded.text(), text);
+    QCOMPARE(loaded.url(), url);
+    QCOMPARE(loaded.description(), text + QStringLiteral("<cdata>"));
+    QCOMPARE(manager->internalDocument().toString(), cached);
+    delete manager;
+    QFile::remove(fileName);
+    QFile::remove(fileName + ".cache");
+}
+
+void KBookmarkTest::testJournal()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/journal.xbel";
+    const QString journalFileName = fileName + ".journal";
+    QFile::remove(fileName);
+    QFile::remove(journalFileName);
+    const auto readFile = [](const QString &name) {
+        QFile file(name);
+        return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    manager->setJournalEnabled(true);
+    QVERIFY(manager->isJournalEnabled());
+    KBookmark kde = manager->root().addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    manager->emitChanged();
+    // No journal to continue yet, so the file was written
+    QVERIFY(readFile(fileName).contains("www.kde.org"));
+    QVERIFY(QFile::exists(journalFileName));
+    const qint64 emptyJournalSize = QFileInfo(journalFileName).size();
+
+    const QByteArray contents = readFile(fileName);
+    kde.setFullText(QStringLiteral("KDE Community"));
+    manager->root().addBookmark(QStringLiteral("Qt"), QUrl(QStringLiteral("http://www.qt.io")), QString());
+    manager->emitChanged();
+    QCOMPARE(readFile(fileName), contents);
+    QVERIFY(QFileInfo(journalFileName).size() > emptyJournalSize);
+    delete manager;
+
+    // Replayed on load, and a record cut short is ignored
+    {
+        QFile journal(journalFileName);
+        QVERIFY(journal.open(QIODevice::Append));
+        journal.write("\x00\x00\x01", 3);
+    }
+    manager = KBookmarkManager::managerForExternalFile(fileName);
+    QCOMPARE(manager->root().first().text(), QStringLiteral("KDE Community"));
+    QCOMPARE(manager->root().next(manager->root().first()).url(), QUrl(QStringLiteral("http://www.qt.io")));
+
+    // Compaction once the journal gets too big
+    manager->setJournalEnabled(true);
+    manager->setJournalCompactionThreshold(0);
+    manager->root().addBookmark(QStringLiteral("KDE Apps"), QUrl(QStringLiteral("http://apps.kde.org")), QString());
+    manager->emitChanged();
+    QVERIFY(readFile(fileName).contains("apps.kde.org"));
+    QCOMPARE(QFileInfo(journalFileName).size(), emptyJournalSize);
+
+    manager->setJournalCompactionThreshold(1024 * 1024);
+    manager->root().first().setFullText(QStringLiteral("KDE e.V."));
+    manager->emitChanged();
+    QVERIFY(!readFile(fileName).contains("KDE e.V."));
+    QVERIFY(manager->compactJournal());
+    QVERIFY(readFile(fileName).contains("KDE e.V."));
+
+    // Folded back into the file
+    manager->setJournalEnabled(false);
+    QVERIFY(!QFile::exists(journalFileName));
+
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testBackups()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/backups.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    for (const QString &backup : manager->availableBackups()) {
+        QFile::remove(backup);
+    }
+    QCOMPARE(manager->backupGenerations(), 1);
+
+    // By default, the previous version goes to the ".bak" file as it always did
+    manager->root().addBookmark(QStringLiteral("legacy"), QUrl(QStringLiteral("http://www.kde.org/legacy")), QString());
+    manager->emitChanged();
+    QVERIFY(manager->availableBackups().isEmpty());
+    manager->root().deleteBookmark(manager->root().first());
+    manager->emitChanged();
+    QCOMPARE(manager->availableBackups(), QStringList(fileName + ".bak"));
+
+    // More generations are named after their time, and leave the ".bak" file alone
+    manager->setBackupGenerations(3);
+    for (int i = 0; i < 5; ++i) {
+        manager->root().addBookmark(QString::number(i), QUrl(QStringLiteral("http://www.kde.org/%1").arg(i)), QString());
+        manager->emitChanged();
+        QThread::msleep(5); // backups are named after the time
+    }
+    QStringList backups = manager->availableBackups();
+    QCOMPARE(backups.count(), 4);
+    QCOMPARE(backups.last(), fileName + ".bak");
+    QVERIFY(KBookmarkManager::backupTime(backups.first()) > KBookmarkManager::backupTime(backups.last()));
+    QVERIFY(qAbs(KBookmarkManager::backupTime(backups.first()).secsTo(QDateTime::currentDateTime())) < 60);
+
+    // The newest backup is the version before the last save
+    QVERIFY(manager->restoreBackup(backups.first()));
+    QCOMPARE(manager->root().next(manager->root().next(manager->root().next(manager->root().first()))).text(), QStringLiteral("3"));
+    QVERIFY(manager->findByUrl(QUrl(QStringLiteral("http://www.kde.org/4"))).isEmpty());
+    // ... and the version restored over got backed up
+    QCOMPARE(manager->availableBackups().count(), 4);
+    QVERIFY(manager->availableBackups().first() != backups.first());
+    QVERIFY(!manager->restoreBackup(fileName));
+
+    // No new backup within the interval
+    backups = manager->availableBackups();
+    manager->setBackupInterval(3600);
+    manager->root().addBookmark(QStringLiteral("5"), QUrl(QStringLiteral("http://www.kde.org/5")), QString());
+    manager->emitChanged();
+    QCOMPARE(manager->availableBackups(), backups);
+
+    // Backups past the maximum age go away
+    const QString oldBackup = fileName + ".bak-2000-01-01_00-00-00.000";
+    QVERIFY(QFile::copy(fileName, oldBackup));
+    QCOMPARE(manager->availableBackups().count(), 5);
+    manager->setBackupGenerations(10);
+    manager->setBackupInterval(0);
+    manager->setBackupMaxAge(30);
+    manager->root().addBookmark(QStringLiteral("6"), QUrl(QStringLiteral("http://www.kde.org/6")), QString());
+    manager->emitChanged();
+    QVERIFY(!QFile::exists(oldBackup));
+    QCOMPARE(manager->availableBackups().count(), 5);
+    QVERIFY(QFile::exists(fileName + ".bak"));
+
+    for (const QString &backup : manager->availableBackups()) {
+        QFile::remove(backup);
+    }
+    delete manager;
+    QFile::remove(fileName);
+}
+
+void KBookmarkTest::testInternalElementEdit()
+{
+    const QString fileName = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation) + "/internal.xbel";
+    QFile::remove(fileName);
+    KBookmarkManager *manager = KBookmarkManager::managerForExternalFile(fileName);
+    KBookmarkGroup folder = manager->root().createNewFolder(QStringLiteral("folder"));
+    const KBookmark kde = folder.addBookmark(QStringLiteral("KDE"), QUrl(QStringLiteral("http://www.kde.org")), QString());
+    // Fills the position and address caches
+    QCOMPARE(kde.address(), QStringLiteral("/0/0"));
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/0")).url(), kde.url());
+
+    // Only reading doesn't count as a change
+    const quint64 generation = manager->generation();
+    const QDomElement kdeElement = kde.internalElement();
+    QCOMPARE(kdeElement.attribute(QStringLiteral("href")), QStringLiteral("http://www.kde.org"));
+    QCOMPARE(manager->generation(), generation);
+
+    QDomElement folderElement = folder.internalElement();
+    QDomElement qtElement = folderElement.ownerDocument().createElement(QStringLiteral("bookmark"));
+    qtElement.setAttribute(QStringLiteral("href"), QStringLiteral("http://www.qt.io"));
+    folderElement.insertBefore(qtElement, kdeElement);
+    manager->emitChanged(folder);
+    QVERIFY(manager->generation() != generation);
+
+    QCOMPARE(KBookmark(qtElement).address(), QStringLiteral("/0/0"));
+    QCOMPARE(kde.address(), QStringLiteral("/0/1"));
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/1")).url(), kde.url());
+    QCOMPARE(manager->findByAddress(QStringLiteral("/0/0")).url(), QUrl(QStringLiteral("http://www.qt.io")));
+    QCOMPARE(manager->findByUrl(QUrl(QStringLiteral("http://www.qt.io"))).count(), 1);
+    delete manager;
+    QFile::remove(fileName);
+}
+
 QTEST_MAIN(KBookmarkTest)
 
 #include "kbookmarktest.moc"
@@ -27,6 +27,7 @@
 #include <kstringhandler.h>
 #include <kurlmimedata.h>
 #include <kbookmarkmanager.h>
+#include "kbookmarkindex_p.h"
 
 #include <qdatetime.h>
 #include <qmimedata.h>
@@ -47,11 +48,6 @@ static QDomNode cd(QDomNode node, const QString &name, bool create)
     return subnode;
 }
 
-static QDomNode cd_or_create(QDomNode node, const QString &name)
-{
-    return cd(node, name, true);
-}
-
 static QDomText get_or_create_text(QDomNode node)
 {
     QDomNode subnode = node.firstChild();
@@ -84,13 +80,182 @@ static QDomNode findMetadata(const QString &forOwner, QDomNode &parent, bool cre
         parent.appendChild(metadataElement);
         metadataElement.setAttribute(QStringLiteral("owner"), forOwner);
 
-    } else if (!metadataElement.isNull() && forOwnerIsKDE) {
+    } else if (create && !metadataElement.isNull() && forOwnerIsKDE) {
         // i'm not sure if this is good, we shouln't take over foreign metatdata
+        // (files loaded by KBookmarkManager had it done by KBookmarkMigration already)
         metadataElement.setAttribute(QStringLiteral("owner"), METADATA_KDE_OWNER);
     }
     return metadataElement;
 }
 
+// The first element named key in the metadata of owner in elem, created if needed and create is true.
+// The index of the document, if any, remembers it, so that it is looked up only once.
+static QDomElement metaDataElement(const QDomElement &elem, const QString &owner, const QString &key, bool create)
+{
+    KBookmarkIndex *index = KBookmarkIndex::forNode(elem);
+    const int atom = index ? index->metaDataAtom(owner, key) : -1;
+    QDomElement item;
+    if (index && index->cachedMetaDataItem(elem, atom, &item) && (!create || !item.isNull())) {
+        return item;
+    }
+    QDomNode infoNode = cd(elem, QStringLiteral("info"), create);
+    if (!infoNode.isNull()) {
+        QDomNode metaDataNode = findMetadata(owner, infoNode, create);
+        if (!metaDataNode.isNull()) {
+            item = cd(metaDataNode, key, create).toElement();
+        }
+    }
+    if (index) {
+        index->insertMetaDataItem(elem, atom, item);
+    }
+    return item;
+}
+
+// Tells the index of the owning document that children of group were added, removed or moved
+static void structureChanged(const QDomElement &group)
+{
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(group)) {
+        index->invalidateGroup(group);
+        index->documentChanged();
+    }
+}
+
+// Creates the children of group if it is loaded lazily
+static void loadChildren(const QDomElement &group)
+{
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(group)) {
+        index->ensureLoaded(group);
+    }
+}
+
+// Tells the index of the owning document that subtree now lives in group, coming from oldParent
+static void subtreeAdded(const QDomElement &group, const QDomElement &oldParent, const QDomElement &subtree)
+{
+    if (!oldParent.isNull() && oldParent.ownerDocument() == group.ownerDocument()) {
+        return; // just moved, the URLs are indexed already
+    }
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(group)) {
+        index->bookmarksAdded(subtree);
+    }
+}
+
+// What QMimeDatabase::mimeTypeForUrl() looks at: the file contents for local
+// files, nothing for web pages, the extension otherwise. Extensions are good
+// enough for an icon, even if a few glob patterns also look at the file name.
+static QString mimeLookupKey(const QUrl &url)
+{
+    if (url.isLocalFile()) {
+        return QLatin1String("file:") + url.toLocalFile();
+    }
+    const QString scheme = url.scheme();
+    if (scheme.startsWith(QLatin1String("http")) || scheme == QLatin1String("mailto")) {
+        return scheme + QLatin1Char(':');
+    }
+    const QString fileName = url.path().section(QLatin1Char('/'), -1);
+    const int dot = fileName.indexOf(QLatin1Char('.'));
+    return scheme + QLatin1Char(':') + (dot > 0 ? fileName.mid(dot).toLower() : fileName);
+}
+
+// The icon of mimeType, or of the mime type of url if it is empty.
+// Cached by the index, if any, since this is called for every menu entry.
+static QString iconForMimeType(const QString &mimeType, const QUrl &url, KBookmarkIndex *index)
+{
+    const QString key = mimeType.isEmpty() ? mimeLookupKey(url) : mimeType;
+    QString icon;
+    if (index && index->cachedIcon(key, &icon)) {
+        return icon;
+    }
+    QMimeDatabase db;
+    const QMimeType mime = mimeType.isEmpty() ? db.mimeTypeForUrl(url) : db.mimeTypeForName(mimeType);
+    if (mime.isValid()) {
+        icon = mime.iconName();
+    }
+    if (index) {
+        index->insertIcon(key, icon);
+    }
+    return icon;
+}
+
+// The log recording the changes of the document of elem for the other processes, if any
+static KBookmarkOpLog *opLog(const QDomElement &elem)
+{
+    KBookmarkIndex *index = KBookmarkIndex::forNode(elem);
+    return index && index->opLog().isEnabled() ? &index->opLog() : nullptr;
+}
+
+// Called by the setters, after changing the title, URL or metadata of elem
+static void fieldChanged(const QDomElement &elem)
+{
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(elem)) {
+        index->documentChanged();
+        if (index->opLog().isEnabled()) {
+            index->opLog().recordUpdate(elem);
+        }
+    }
+}
+
+static bool hasId(const QString &tag)
+{
+    return tag == QLatin1String("folder") || tag == QLatin1String("bookmark");
+}
+
+// Gives the folders and bookmarks of subtree an id, unless they have one already
+static void assignMissingIds(QDomElement subtree)
+{
+    const QString tag = subtree.tagName();
+    if (!hasId(tag)) {
+        return;
+    }
+    if (!subtree.hasAttribute(QStringLiteral("id"))) {
+        subtree.setAttribute(QStringLiteral("id"), KBookmarkIndex::createId());
+    }
+    if (tag == QLatin1String("folder")) {
+        for (QDomElement e = subtree.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            assignMissingIds(e);
+        }
+    }
+}
+
+// Folders and bookmarks added to a bookmark file get their id right away, so
+// that KBookmark::id() only has to read it. Moves within the file keep it.
+static void assignIds(const QDomElement &group, const QDomElement &oldParent, const QDomElement &subtree)
+{
+    if (!oldParent.isNull() && oldParent.ownerDocument() == group.ownerDocument()) {
+        return;
+    }
+    if (KBookmarkIndex::forNode(group)) {
+        assignMissingIds(subtree);
+    }
+}
+
+// Where the access metadata of elem is stored, if not in the XBEL metadata
+static KBookmarkAccessStats *accessStats(const QDomElement &elem)
+{
+    KBookmarkIndex *index = KBookmarkIndex::forNode(elem);
+    return index ? index->accessStats() : nullptr;
+}
+
+// The address of item if it is moved within the document of group, a null string otherwise
+static QString moveSourceAddress(KBookmarkOpLog *log, const QDomElement &group, const QDomElement &item)
+{
+    if (!log || item.ownerDocument() != group.ownerDocument() || !KBookmarkOpLog::isInDocument(item)) {
+        return QString();
+    }
+    return KBookmark(item).address();
+}
+
+// Records item being inserted or moved into its current position
+static void recordInsertOrMove(KBookmarkOpLog *log, const QString &fromAddress, const QDomElement &item)
+{
+    if (!log) {
+        return;
+    } else if (fromAddress.isNull()) {
+        log->recordInsert(item);
+    } else {
+        log->recordMove(fromAddress, item);
+    }
+}
+
 //////
 
 KBookmarkGroup::KBookmarkGroup()
@@ -110,6 +275,7 @@ bool KBookmarkGroup::isOpen() const
 
 KBookmark KBookmarkGroup::first() const
 {
+    loadChildren(element);
     return KBookmark(nextKnownTag(element.firstChildElement(), true));
 }
 
@@ -125,6 +291,10 @@ KBookmark KBookmarkGroup::next(const KBookmark &current) const
 
 int KBookmarkGroup::indexOf(const KBookmark &child) const
 {
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        return index->position(element, child.element);
+    }
+
     int counter = 0;
     for (KBookmark bk = first(); !bk.isNull(); bk = next(bk), ++counter) {
         if (bk.element == child.element) {
@@ -134,7 +304,8 @@ int KBookmarkGroup::indexOf(const KBookmark &child) const
     return -1;
 }
 
-QDomElement KBookmarkGroup::nextKnownTag(const QDomElement &start, bool goNext) const
+// The first folder, bookmark or separator from start on, going forward or backward
+static QDomElement knownTag(const QDomElement &start, bool goNext)
 {
     for (QDomElement elem = start; !elem.isNull();) {
         QString tag = elem.tagName();
@@ -151,17 +322,27 @@ QDomElement KBookmarkGroup::nextKnownTag(const QDomElement &start, bool goNext)
     return QDomElement();
 }
 
+QDomElement KBookmarkGroup::nextKnownTag(const QDomElement &start, bool goNext) const
+{
+    return knownTag(start, goNext);
+}
+
 KBookmarkGroup KBookmarkGroup::createNewFolder(const QString &text)
 {
     if (isNull()) {
         return KBookmarkGroup();
     }
+    loadChildren(element);
     QDomDocument doc = element.ownerDocument();
     QDomElement groupElem = doc.createElement(QStringLiteral("folder"));
     element.appendChild(groupElem);
     QDomElement textElem = doc.createElement(QStringLiteral("title"));
     groupElem.appendChild(textElem);
     textElem.appendChild(doc.createTextNode(text));
+    assignIds(element, QDomElement(), groupElem);
+    structureChanged(element);
+    recordInsertOrMove(opLog(element), QString(), groupElem);
+    subtreeAdded(element, QDomElement(), groupElem);
     return KBookmarkGroup(groupElem);
 
 }
@@ -171,15 +352,22 @@ KBookmark KBookmarkGroup::createNewSeparator()
     if (isNull()) {
         return KBookmark();
     }
+    loadChildren(element);
     QDomDocument doc = element.ownerDocument();
     Q_ASSERT(!doc.isNull());
     QDomElement sepElem = doc.createElement(QStringLiteral("separator"));
     element.appendChild(sepElem);
+    structureChanged(element);
+    recordInsertOrMove(opLog(element), QString(), sepElem);
     return KBookmark(sepElem);
 }
 
 bool KBookmarkGroup::moveBookmark(const KBookmark &item, const KBookmark &after)
 {
+    const QDomElement oldParent = item.element.parentNode().toElement(); // can be another group
+    loadChildren(element);
+    KBookmarkOpLog *log = opLog(element);
+    const QString fromAddress = moveSourceAddress(log, element, item.element);
     QDomNode n;
     if (!after.isNull()) {
         n = element.insertAfter(item.element, after.element);
@@ -200,12 +388,28 @@ bool KBookmarkGroup::moveBookmark(const KBookmark &item, const KBookmark &after)
             n = element.appendChild(item.element);
         }
     }
+    assignIds(element, oldParent, item.element);
+    structureChanged(oldParent);
+    structureChanged(element);
+    // Recorded first, as the index may give a copy a new id
+    recordInsertOrMove(log, fromAddress, item.element);
+    subtreeAdded(element, oldParent, item.element);
     return (!n.isNull());
 }
 
 KBookmark KBookmarkGroup::addBookmark(const KBookmark &bm)
 {
-    element.appendChild(bm.internalElement());
+    const QDomElement oldParent = bm.element.parentNode().toElement(); // appendChild moves bm out of it
+    loadChildren(element);
+    KBookmarkOpLog *log = opLog(element);
+    const QString fromAddress = moveSourceAddress(log, element, bm.element);
+    element.appendChild(bm.element);
+    assignIds(element, oldParent, bm.element);
+    structureChanged(oldParent);
+    structureChanged(element);
+    // Recorded first, as the index may give a copy a new id
+    recordInsertOrMove(log, fromAddress, bm.element);
+    subtreeAdded(element, oldParent, bm.element);
     return bm;
 }
 
@@ -229,9 +433,83 @@ KBookmark KBookmarkGroup::addBookmark(const QString &text, const QUrl &url, cons
     return newBookmark;
 }
 
+KBookmark::List KBookmarkGroup::addBookmarks(const QVector<NewBookmark> &bookmarks)
+{
+    KBookmark::List result;
+    if (isNull() || bookmarks.isEmpty()) {
+        return result;
+    }
+    loadChildren(element);
+    QDomDocument doc = element.ownerDocument();
+    const QString bookmarkTag = QStringLiteral("bookmark");
+    const QString hrefAttribute = QStringLiteral("href");
+    const QString titleTag = QStringLiteral("title");
+    const QString infoTag = QStringLiteral("info");
+    const QString metadataTag = QStringLiteral("metadata");
+    const QString ownerAttribute = QStringLiteral("owner");
+    const QString iconOwner = QStringLiteral(METADATA_FREEDESKTOP_OWNER);
+    const QString iconTag = QStringLiteral("bookmark:icon");
+    const QString nameAttribute = QStringLiteral("name");
+    const QString idAttribute = QStringLiteral("id");
+    const bool managed = KBookmarkIndex::forNode(element) != nullptr;
+    // Imports use the same few icons over and over, let them share their data
+    QHash<QString, QString> icons;
+
+    // Same structure as addBookmark() and setIcon() create, without looking up anything
+    QDomDocumentFragment fragment = doc.createDocumentFragment();
+    result.reserve(bookmarks.count());
+    for (const NewBookmark &bookmark : bookmarks) {
+        QDomElement elem = doc.createElement(bookmarkTag);
+        elem.setAttribute(hrefAttribute, bookmark.url.toString(QUrl::FullyEncoded));
+        if (managed) {
+            elem.setAttribute(idAttribute, KBookmarkIndex::createId());
+        }
+        QDomElement textElem = doc.createElement(titleTag);
+        textElem.appendChild(doc.createTextNode(bookmark.text));
+        elem.appendChild(textElem);
+
+        QHash<QString, QString>::const_iterator icon = icons.constFind(bookmark.icon);
+        if (icon == icons.constEnd()) {
+            icon = icons.insert(bookmark.icon, bookmark.icon);
+        }
+        QDomElement infoElem = doc.createElement(infoTag);
+        QDomElement metadataElem = doc.createElement(metadataTag);
+        metadataElem.setAttribute(ownerAttribute, iconOwner);
+        QDomElement iconElem = doc.createElement(iconTag);
+        iconElem.setAttribute(nameAttribute, icon.value());
+        metadataElem.appendChild(iconElem);
+        infoElem.appendChild(metadataElem);
+        elem.appendChild(infoElem);
+
+        fragment.appendChild(elem);
+        result.append(KBookmark(elem));
+    }
+    element.appendChild(fragment);
+
+    structureChanged(element);
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        for (int i = 0; i < result.count(); ++i) {
+            index->bookmarksAdded(result.at(i).element);
+        }
+        // Reloading is cheaper for the other processes than thousands of operations
+        if (KBookmarkOpLog::isInDocument(element)) {
+            index->opLog().setTainted();
+        }
+    }
+    return result;
+}
+
 void KBookmarkGroup::deleteBookmark(const KBookmark &bk)
 {
+    KBookmarkOpLog *log = opLog(element);
+    if (log && bk.element.parentNode() == element && KBookmarkOpLog::isInDocument(element)) {
+        log->recordDelete(bk.address());
+    }
     element.removeChild(bk.element);
+    structureChanged(element);
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        index->bookmarksRemoved(bk.element);
+    }
 }
 
 bool KBookmarkGroup::isToolbarGroup() const
@@ -244,6 +522,12 @@ QDomElement KBookmarkGroup::findToolbar() const
     if (element.attribute(QStringLiteral("toolbar")) == QLatin1String("yes")) {
         return element;
     }
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        if (!index->mayContainToolbar(element)) {
+            return QDomElement(); // don't load lazily loaded folders for nothing
+        }
+        index->ensureLoaded(element);
+    }
     for (QDomElement e = element.firstChildElement(QStringLiteral("folder")); !e.isNull();
          e = e.nextSiblingElement(QStringLiteral("folder")) ) {
         QDomElement result = KBookmarkGroup(e).findToolbar();
@@ -257,15 +541,186 @@ QDomElement KBookmarkGroup::findToolbar() const
 QList<QUrl> KBookmarkGroup::groupUrlList() const
 {
     QList<QUrl> urlList;
-    for (KBookmark bm = first(); !bm.isNull(); bm = next(bm)) {
-        if (bm.isSeparator() || bm.isGroup()) {
-            continue;
-        }
+    for (const KBookmark &bm : bookmarks()) {
         urlList << bm.url();
     }
     return urlList;
 }
 
+KBookmarkChildRange KBookmarkGroup::children() const
+{
+    return KBookmarkChildRange(element, KBookmarkChildIterator::AllChildren);
+}
+
+KBookmarkChildRange KBookmarkGroup::folders() const
+{
+    return KBookmarkChildRange(element, KBookmarkChildIterator::Folders);
+}
+
+KBookmarkChildRange KBookmarkGroup::bookmarks() const
+{
+    return KBookmarkChildRange(element, KBookmarkChildIterator::Bookmarks);
+}
+
+KBookmarkDescendantRange KBookmarkGroup::descendants() const
+{
+    return KBookmarkDescendantRange(element);
+}
+
+//////
+
+KBookmarkChildIterator::KBookmarkChildIterator()
+    : m_position(-1)
+    , m_filter(AllChildren)
+{
+}
+
+KBookmarkChildIterator::KBookmarkChildIterator(const QDomElement &group, Filter filter)
+    : m_group(group)
+    , m_position(-1)
+    , m_filter(filter)
+{
+}
+
+static bool matchesFilter(const QDomElement &elem, KBookmarkChildIterator::Filter filter)
+{
+    switch (filter) {
+    case KBookmarkChildIterator::Folders:
+        return elem.tagName() == QLatin1String("folder");
+    case KBookmarkChildIterator::Bookmarks:
+        return elem.tagName() == QLatin1String("bookmark");
+    case KBookmarkChildIterator::AllChildren:
+        break;
+    }
+    return true;
+}
+
+void KBookmarkChildIterator::toFirst()
+{
+    // The index has the children of the group in an array already
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(m_group)) {
+        m_position = 0;
+        m_current = index->child(m_group, 0);
+    } else {
+        m_current = knownTag(m_group.firstChildElement(), true);
+    }
+    if (!m_current.isNull() && !matchesFilter(m_current, m_filter)) {
+        step(true);
+    }
+}
+
+void KBookmarkChildIterator::step(bool forward)
+{
+    KBookmarkIndex *index = KBookmarkIndex::forNode(m_group);
+    do {
+        if (m_current.isNull()) {
+            if (forward) {
+                return; // stays at the end
+            }
+            if (index) {
+                m_position = index->childCount(m_group) - 1;
+                m_current = index->child(m_group, m_position);
+            } else {
+                m_current = knownTag(m_group.lastChildElement(), false);
+            }
+        } else if (index) {
+            m_position += forward ? 1 : -1;
+            m_current = index->child(m_group, m_position);
+        } else {
+            m_current = forward ? knownTag(m_current.nextSiblingElement(), true)
+                        : knownTag(m_current.previousSiblingElement(), false);
+        }
+    } while (!m_current.isNull() && !matchesFilter(m_current, m_filter));
+}
+
+KBookmarkChildIterator &KBookmarkChildIterator::operator++()
+{
+    step(true);
+    return *this;
+}
+
+KBookmarkChildIterator &KBookmarkChildIterator::operator--()
+{
+    step(false);
+    return *this;
+}
+
+KBookmarkChildRange::KBookmarkChildRange(const QDomElement &group, KBookmarkChildIterator::Filter filter)
+    : m_group(group)
+    , m_filter(filter)
+{
+}
+
+KBookmarkChildIterator KBookmarkChildRange::begin() const
+{
+    KBookmarkChildIterator it(m_group, m_filter);
+    it.toFirst();
+    return it;
+}
+
+KBookmarkChildIterator KBookmarkChildRange::end() const
+{
+    return KBookmarkChildIterator(m_group, m_filter);
+}
+
+KBookmarkDescendantIterator::KBookmarkDescendantIterator()
+{
+}
+
+KBookmarkDescendantIterator::KBookmarkDescendantIterator(const QDomElement &group)
+{
+    KBookmarkChildIterator it(group, KBookmarkChildIterator::AllChildren);
+    it.toFirst();
+    if (!it.m_current.isNull()) {
+        m_path.append(it);
+    }
+}
+
+KBookmarkDescendantIterator &KBookmarkDescendantIterator::operator++()
+{
+    const QDomElement current = m_path.last().m_current;
+    if (current.tagName() == QLatin1String("folder")) {
+        KBookmarkChildIterator it(current, KBookmarkChildIterator::AllChildren);
+        it.toFirst();
+        if (!it.m_current.isNull()) {
+            m_path.append(it);
+            return *this;
+        }
+    }
+    // Leave the folders which are done
+    while (!m_path.isEmpty()) {
+        ++m_path.last();
+        if (!m_path.last().m_current.isNull()) {
+            break;
+        }
+        m_path.removeLast();
+    }
+    return *this;
+}
+
+bool KBookmarkDescendantIterator::operator==(const KBookmarkDescendantIterator &other) const
+{
+    if (m_path.isEmpty() || other.m_path.isEmpty()) {
+        return m_path.isEmpty() == other.m_path.isEmpty();
+    }
+    return m_path.last() == other.m_path.last();
+}
+
+KBookmarkDescendantRange::KBookmarkDescendantRange(const QDomElement &group)
+    : m_group(group)
+{
+}
+
+KBookmarkDescendantIterator KBookmarkDescendantRange::begin() const
+{
+    return KBookmarkDescendantIterator(m_group);
+}
+
+KBookmarkDescendantIterator KBookmarkDescendantRange::end() const
+{
+    return KBookmarkDescendantIterator();
+}
+
 //////
 
 KBookmark::KBookmark()
@@ -301,6 +756,9 @@ bool KBookmark::hasParent() const
 
 QString KBookmark::text() const
 {
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        return index->text(element);
+    }
     return KStringHandler::csqueeze(fullText());
 }
 
@@ -330,26 +788,39 @@ void KBookmark::setFullText(const QString &fullText)
 
     QDomText domtext = titleNode.firstChild().toText();
     domtext.setData(fullText);
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        index->fieldsChanged(element);
+    }
+    fieldChanged(element);
 }
 
 QUrl KBookmark::url() const
 {
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        return index->url(element);
+    }
     return QUrl(element.attribute(QStringLiteral("href")));
 }
 
 void KBookmark::setUrl(const QUrl &url)
 {
+    const QString oldHref = element.attribute(QStringLiteral("href"));
     element.setAttribute(QStringLiteral("href"), url.toString());
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        index->fieldsChanged(element);
+        index->urlChanged(element, oldHref);
+    }
+    fieldChanged(element);
 }
 
 QString KBookmark::icon() const
 {
-    QDomNode metaDataNode = metaData(METADATA_FREEDESKTOP_OWNER, false);
-    QDomElement iconElement = cd(metaDataNode, QStringLiteral("bookmark:icon"), false).toElement();
+    const QDomElement iconElement = metaDataElement(element, METADATA_FREEDESKTOP_OWNER, QStringLiteral("bookmark:icon"), false);
 
     QString icon = iconElement.attribute(QStringLiteral("name"));
 
-    // migration code
+    // migration code, for bookmarks not loaded by KBookmarkManager (drag and drop...):
+    // KBookmarkMigration upgrades the files when they are loaded
     if (icon.isEmpty()) {
         icon = element.attribute(QStringLiteral("icon"));
     }
@@ -371,17 +842,7 @@ QString KBookmark::icon() const
                 icon = QStringLiteral("edit-clear"); // whatever
             } else {
                 // get icon from mimeType
-                QMimeDatabase db;
-                QMimeType mime;
-                QString _mimeType = mimeType();
-                if (!_mimeType.isEmpty()) {
-                    mime = db.mimeTypeForName(_mimeType);
-                } else {
-                    mime = db.mimeTypeForUrl(url());
-                }
-                if (mime.isValid()) {
-                    icon = mime.iconName();
-                }
+                icon = iconForMimeType(mimeType(), url(), KBookmarkIndex::forNode(element));
             }
         }
     }
@@ -390,14 +851,14 @@ QString KBookmark::icon() const
 
 void KBookmark::setIcon(const QString &icon)
 {
-    QDomNode metaDataNode = metaData(METADATA_FREEDESKTOP_OWNER, true);
-    QDomElement iconElement = cd_or_create(metaDataNode, QStringLiteral("bookmark:icon")).toElement();
+    QDomElement iconElement = metaDataElement(element, METADATA_FREEDESKTOP_OWNER, QStringLiteral("bookmark:icon"), true);
     iconElement.setAttribute(QStringLiteral("name"), icon);
 
     // migration code
     if (!element.attribute(QStringLiteral("icon")).isEmpty()) {
         element.removeAttribute(QStringLiteral("icon"));
     }
+    fieldChanged(element);
 }
 
 QString KBookmark::description() const
@@ -426,34 +887,34 @@ void KBookmark::setDescription(const QString &description)
 
     QDomText domtext = descNode.firstChild().toText();
     domtext.setData(description);
+    fieldChanged(element);
 }
 
 QString KBookmark::mimeType() const
 {
-    QDomNode metaDataNode = metaData(METADATA_MIME_OWNER, false);
-    QDomElement mimeTypeElement = cd(metaDataNode, QStringLiteral("mime:mime-type"), false).toElement();
+    const QDomElement mimeTypeElement = metaDataElement(element, METADATA_MIME_OWNER, QStringLiteral("mime:mime-type"), false);
     return mimeTypeElement.attribute(QStringLiteral("type"));
 }
 
 void KBookmark::setMimeType(const QString &mimeType)
 {
-    QDomNode metaDataNode = metaData(METADATA_MIME_OWNER, true);
-    QDomElement iconElement = cd_or_create(metaDataNode, QStringLiteral("mime:mime-type")).toElement();
+    QDomElement iconElement = metaDataElement(element, METADATA_MIME_OWNER, QStringLiteral("mime:mime-type"), true);
     iconElement.setAttribute(QStringLiteral("type"), mimeType);
+    fieldChanged(element);
 }
 
 bool KBookmark::showInToolbar() const
 {
+    // Old format, only found in bookmarks not loaded by KBookmarkManager (see KBookmarkMigration)
     if (element.hasAttribute(QStringLiteral("showintoolbar"))) {
-        bool show = element.attribute(QStringLiteral("showintoolbar")) == QLatin1String("yes");
-        const_cast<QDomElement *>(&element)->removeAttribute(QStringLiteral("showintoolbar"));
-        const_cast<KBookmark *>(this)->setShowInToolbar(show);
+        return element.attribute(QStringLiteral("showintoolbar")) == QLatin1String("yes");
     }
     return  metaDataItem(QStringLiteral("showintoolbar")) == QLatin1String("yes");
 }
 
 void KBookmark::setShowInToolbar(bool show)
 {
+    element.removeAttribute(QStringLiteral("showintoolbar"));
     setMetaDataItem(QStringLiteral("showintoolbar"), show ? "yes" : "no");
 }
 
@@ -472,7 +933,10 @@ QString KBookmark::address() const
 {
     if (element.tagName() == QLatin1String("xbel")) {
         return QLatin1String("");    // not QString() !
-    } else {
+    }
+
+    KBookmarkIndex *index = KBookmarkIndex::forNode(element);
+    if (!index) {
         // Use keditbookmarks's DEBUG_ADDRESSES flag to debug this code :)
         if (element.parentNode().isNull()) {
             Q_ASSERT(false);
@@ -484,6 +948,46 @@ QString KBookmark::address() const
         Q_ASSERT(pos != -1);
         return parentAddress + '/' + QString::number(pos);
     }
+
+    // Same as above, looking up the cached position at each level
+    QString address;
+    for (QDomElement elem = element; elem.tagName() != QLatin1String("xbel");) {
+        const QDomElement parent = elem.parentNode().toElement();
+        if (parent.isNull()) {
+            Q_ASSERT(false);
+            return QStringLiteral("ERROR");
+        }
+        const int pos = index->position(parent, elem);
+        Q_ASSERT(pos != -1);
+        address.prepend(QLatin1Char('/') + QString::number(pos));
+        elem = parent;
+    }
+    return address;
+}
+
+QString KBookmark::id() const
+{
+    if (!hasId(element.tagName())) {
+        return QString();
+    }
+    return element.attribute(QStringLiteral("id"));
+}
+
+QString KBookmark::ensureId()
+{
+    if (!hasId(element.tagName())) {
+        return QString();
+    }
+    QString id = element.attribute(QStringLiteral("id"));
+    if (id.isEmpty()) {
+        id = KBookmarkIndex::createId();
+        element.setAttribute(QStringLiteral("id"), id);
+        if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+            index->idAssigned(element);
+        }
+        fieldChanged(element);
+    }
+    return id;
 }
 
 int KBookmark::positionInParent() const
@@ -493,6 +997,12 @@ int KBookmark::positionInParent() const
 
 QDomElement KBookmark::internalElement() const
 {
+    // The caller might look at anything below, and change it behind our back:
+    // the caches are dropped once the changes are reported by emitChanged()
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        index->ensureSubtreeLoaded(element);
+        index->setDirectAccess();
+    }
     return element;
 }
 
@@ -536,6 +1046,25 @@ void KBookmark::updateAccessMetadata()
     // qCDebug(KBOOKMARKS_LOG) << "KBookmark::updateAccessMetadata " << address() << " " << url();
 
     const uint timet = QDateTime::currentDateTime().toTime_t();
+    // The store finds bookmarks by their id, the ones without go to the XBEL metadata
+    // as before: giving them one here would change the bookmark file after all
+    const QString id = element.attribute(QStringLiteral("id"));
+    KBookmarkAccessStats *stats = id.isEmpty() ? nullptr : accessStats(element);
+    if (stats) {
+        // Not worth rewriting the bookmark file for
+        stats->refresh();
+        KBookmarkAccessStats::Entry entry;
+        entry.timeAdded = metaDataItem(QStringLiteral("time_added"));
+        if (entry.timeAdded.isEmpty()) {
+            entry.timeAdded = QString::number(timet);
+        }
+        entry.timeVisited = QString::number(timet);
+        entry.visitCount = metaDataItem(QStringLiteral("visit_count")).toInt() + 1;
+        if (stats->record(id, entry)) {
+            return;
+        }
+    }
+
     setMetaDataItem(QStringLiteral("time_added"), QString::number(timet), DontOverwriteMetaData);
     setMetaDataItem(QStringLiteral("time_visited"), QString::number(timet));
 
@@ -577,34 +1106,63 @@ QString KBookmark::nextAddress(const QString &address)
 
 QDomNode KBookmark::metaData(const QString &owner, bool create) const
 {
-    QDomNode infoNode = cd(internalElement(), QStringLiteral("info"), create);
-    if (infoNode.isNull()) {
-        return QDomNode();
+    QDomNode infoNode = cd(element, QStringLiteral("info"), false);
+    QDomNode metaDataNode = infoNode.isNull() ? QDomNode() : findMetadata(owner, infoNode, false);
+    if (!create) {
+        return metaDataNode;
+    }
+    // The caller can change the items behind the back of metaDataItem(),
+    // which is taken into account by the next emitChanged()
+    KBookmarkIndex *index = KBookmarkIndex::forNode(element);
+    if (index) {
+        index->setDirectAccess();
     }
-    return findMetadata(owner, infoNode, create);
+    if (metaDataNode.isNull() || metaDataNode.toElement().attribute(QStringLiteral("owner")) != owner) {
+        infoNode = cd(element, QStringLiteral("info"), true);
+        metaDataNode = findMetadata(owner, infoNode, true);
+        if (index) {
+            index->fieldsChanged(element);
+        }
+        fieldChanged(element);
+    }
+    return metaDataNode;
 }
 
 QString KBookmark::metaDataItem(const QString &key) const
 {
-    QDomNode metaDataNode = metaData(METADATA_KDE_OWNER, false);
-    for (QDomElement e = metaDataNode.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
-        if (e.tagName() == key) {
-            return e.text();
+    if (KBookmarkAccessStats::isStatistic(key)) {
+        KBookmarkAccessStats *stats = accessStats(element);
+        QString value;
+        if (stats && stats->value(element.attribute(QStringLiteral("id")), key, &value)) {
+            return value;
         }
     }
-    return QString();
+    return metaDataElement(element, METADATA_KDE_OWNER, key, false).text();
 }
 
 void KBookmark::setMetaDataItem(const QString &key, const QString &value, MetaDataOverwriteMode mode)
 {
-    QDomNode metaDataNode = metaData(METADATA_KDE_OWNER, true);
-    QDomNode item = cd_or_create(metaDataNode, key);
+    if (KBookmarkAccessStats::isStatistic(key)) {
+        // The XBEL value is shadowed by the one in the store
+        KBookmarkAccessStats *stats = accessStats(element);
+        const QString id = element.attribute(QStringLiteral("id"));
+        QString oldValue;
+        if (stats && stats->value(id, key, &oldValue)) {
+            if (mode == OverwriteMetaData || oldValue.isEmpty()) {
+                stats->setValue(id, key, value);
+            }
+            return;
+        }
+    }
+
+    QDomElement item = metaDataElement(element, METADATA_KDE_OWNER, key, true);
     QDomText text = get_or_create_text(item);
     if (mode == DontOverwriteMetaData && !text.data().isEmpty()) {
         return;
     }
 
     text.setData(value);
+    fieldChanged(element);
 }
 
 bool KBookmark::operator==(const KBookmark &rhs) const
@@ -678,7 +1236,10 @@ void KBookmark::List::populateMimeData(QMimeData *mimeData) const
 
     for (const_iterator it = begin(), end = this->end(); it != end; ++it) {
         urls.append((*it).url());
-        elem.appendChild((*it).internalElement().cloneNode(true /* deep */));
+        if (KBookmarkIndex *index = KBookmarkIndex::forNode((*it).element)) {
+            index->ensureSubtreeLoaded((*it).element);
+        }
+        elem.appendChild((*it).element.cloneNode(true /* deep */));
     }
 
     // This sets text/uri-list and text/plain into the mimedata
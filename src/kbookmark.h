@@ -23,12 +23,18 @@
 #include <QString>
 #include <QUrl>
 #include <QList>
+#include <QVector>
 #include <QMetaType>
 #include <QDomElement>
 
+#include <cstddef>
+#include <iterator>
+
 class QMimeData;
 class KBookmarkManager;
 class KBookmarkGroup;
+class KBookmarkChildRange;
+class KBookmarkDescendantRange;
 
 class KBOOKMARKS_EXPORT KBookmark
 {
@@ -223,6 +229,28 @@ public:
      */
     QString address() const;
 
+    /**
+     * Return an id identifying this bookmark or folder in its bookmark file.
+     * Unlike the address(), it doesn't change when the bookmark is moved
+     * or other bookmarks are added before it, see KBookmarkManager::findById().
+     *
+     * It is created when the bookmark is added to a bookmark file (and then
+     * saved with it), copies added to the same bookmark file get their own.
+     * Bookmarks read from files written by other programs may have none,
+     * see ensureId().
+     * @return an empty string for separators, the root group, null bookmarks
+     * and bookmarks without an id
+     * @since 5.50
+     */
+    QString id() const;
+
+    /**
+     * Same as id(), but gives the bookmark or folder an id if it has none yet.
+     * This changes the bookmark, which has to be saved like any other change.
+     * @since 5.50
+     */
+    QString ensureId();
+
     /**
      * Return the position in the parent, i.e. the last number in the address
      */
@@ -236,6 +264,12 @@ public:
 
     /**
      * @internal for KEditBookmarks
+     *
+     * Whoever changes the DOM through the returned element has to call
+     * KBookmarkManager::emitChanged() before using the KBookmark API again:
+     * the caches of the manager are only dropped then, until then address()
+     * or KBookmarkManager::findByAddress() may return results computed
+     * before the change. Merely reading through it costs nothing.
      */
     QDomElement internalElement() const;
 
@@ -277,6 +311,9 @@ public:
 
     /**
      * @return the metadata container node for a certain matadata owner
+     *
+     * With @p create set to false, this only reads the metadata: use true
+     * to change it, and call KBookmarkManager::emitChanged() afterwards.
      * @since 4.1
      */
     QDomNode metaData(const QString &owner, bool create) const;
@@ -394,6 +431,26 @@ public:
      */
     KBookmark addBookmark(const QString &text, const QUrl &url, const QString &icon);
 
+    /**
+     * A bookmark to create with addBookmarks()
+     * @since 5.50
+     */
+    struct NewBookmark {
+        QString text;
+        QUrl url;
+        QString icon;
+    };
+
+    /**
+     * Same as calling addBookmark(text, url, icon) for each of @p bookmarks,
+     * but much faster when importing many bookmarks: the elements are
+     * created in one go and appended to this group at once.
+     * Don't forget to use KBookmarkManager::emitChanged() afterwards.
+     * @return the new bookmarks
+     * @since 5.50
+     */
+    KBookmark::List addBookmarks(const QVector<NewBookmark> &bookmarks);
+
     /**
      * Moves @p bookmark after @p after (which should be a child of ours).
      * If after is null, @p bookmark is moved as the first child.
@@ -421,6 +478,37 @@ public:
      */
     QList<QUrl> groupUrlList() const;
 
+    /**
+     * @return the folders, bookmarks and separators in this group, for
+     * range-based for loops and algorithms:
+     * \code
+     * for (const KBookmark &bookmark : group.children()) {
+     *     ...
+     * }
+     * \endcode
+     * This is faster than walking them with first() and next().
+     * Like the iterators of Qt containers, the iterators become invalid
+     * when children are added to or removed from the group.
+     * @since 5.50
+     */
+    KBookmarkChildRange children() const;
+    /**
+     * Same as children(), only the folders
+     * @since 5.50
+     */
+    KBookmarkChildRange folders() const;
+    /**
+     * Same as children(), only the bookmarks (no folders or separators)
+     * @since 5.50
+     */
+    KBookmarkChildRange bookmarks() const;
+    /**
+     * @return all folders, bookmarks and separators below this group,
+     * depth first: each folder comes right before its contents
+     * @since 5.50
+     */
+    KBookmarkDescendantRange descendants() const;
+
 protected:
     QDomElement nextKnownTag(const QDomElement &start, bool goNext) const;
 
@@ -432,6 +520,158 @@ private:
     // has to be implemented as an attribute of the QDomElement.
 };
 
+/**
+ * Iterates over the children of a KBookmarkGroup, see KBookmarkGroup::children().
+ * Dereferencing it creates the KBookmark wrapping the child.
+ * @since 5.50
+ */
+class KBOOKMARKS_EXPORT KBookmarkChildIterator
+{
+public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef KBookmark value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef void pointer;
+    typedef KBookmark reference;
+
+    enum Filter {
+        AllChildren,
+        Folders,
+        Bookmarks
+    };
+
+    KBookmarkChildIterator();
+
+    KBookmark operator*() const
+    {
+        return KBookmark(m_current);
+    }
+    KBookmarkChildIterator &operator++();
+    KBookmarkChildIterator operator++(int)
+    {
+        KBookmarkChildIterator it = *this;
+        ++*this;
+        return it;
+    }
+    KBookmarkChildIterator &operator--();
+    KBookmarkChildIterator operator--(int)
+    {
+        KBookmarkChildIterator it = *this;
+        --*this;
+        return it;
+    }
+    bool operator==(const KBookmarkChildIterator &other) const
+    {
+        return m_current == other.m_current;
+    }
+    bool operator!=(const KBookmarkChildIterator &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    friend class KBookmarkChildRange;
+    friend class KBookmarkDescendantIterator;
+    // At the end, see toFirst()
+    KBookmarkChildIterator(const QDomElement &group, Filter filter);
+    void toFirst();
+    void step(bool forward);
+
+    QDomElement m_group;
+    QDomElement m_current; // null at the end
+    int m_position;        // of m_current in the group
+    Filter m_filter;
+};
+
+/**
+ * The children of a KBookmarkGroup, see KBookmarkGroup::children()
+ * @since 5.50
+ */
+class KBOOKMARKS_EXPORT KBookmarkChildRange
+{
+public:
+    typedef KBookmarkChildIterator iterator;
+    typedef KBookmarkChildIterator const_iterator;
+
+    KBookmarkChildIterator begin() const;
+    KBookmarkChildIterator end() const;
+
+private:
+    friend class KBookmarkGroup;
+    KBookmarkChildRange(const QDomElement &group, KBookmarkChildIterator::Filter filter);
+
+    QDomElement m_group;
+    KBookmarkChildIterator::Filter m_filter;
+};
+
+/**
+ * Walks the tree below a KBookmarkGroup, see KBookmarkGroup::descendants()
+ * @since 5.50
+ */
+class KBOOKMARKS_EXPORT KBookmarkDescendantIterator
+{
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef KBookmark value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef void pointer;
+    typedef KBookmark reference;
+
+    KBookmarkDescendantIterator();
+
+    KBookmark operator*() const
+    {
+        return KBookmark(m_path.last().m_current);
+    }
+    KBookmarkDescendantIterator &operator++();
+    KBookmarkDescendantIterator operator++(int)
+    {
+        KBookmarkDescendantIterator it = *this;
+        ++*this;
+        return it;
+    }
+    bool operator==(const KBookmarkDescendantIterator &other) const;
+    bool operator!=(const KBookmarkDescendantIterator &other) const
+    {
+        return !(*this == other);
+    }
+    /**
+     * @return how many folders the current bookmark is in, below the
+     * group descendants() was called on; 0 for its children
+     */
+    int depth() const
+    {
+        return m_path.count() - 1;
+    }
+
+private:
+    friend class KBookmarkDescendantRange;
+    explicit KBookmarkDescendantIterator(const QDomElement &group);
+
+    // One iterator per level, empty at the end
+    QVector<KBookmarkChildIterator> m_path;
+};
+
+/**
+ * The tree below a KBookmarkGroup, see KBookmarkGroup::descendants()
+ * @since 5.50
+ */
+class KBOOKMARKS_EXPORT KBookmarkDescendantRange
+{
+public:
+    typedef KBookmarkDescendantIterator iterator;
+    typedef KBookmarkDescendantIterator const_iterator;
+
+    KBookmarkDescendantIterator begin() const;
+    KBookmarkDescendantIterator end() const;
+
+private:
+    friend class KBookmarkGroup;
+    explicit KBookmarkDescendantRange(const QDomElement &group);
+
+    QDomElement m_group;
+};
+
 class KBOOKMARKS_EXPORT KBookmarkGroupTraverser
 {
 protected:
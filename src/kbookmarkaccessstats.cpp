@@ -0,0 +1,189 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkaccessstats_p.h"
+#include "kbookmarks_debug.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+KBookmarkAccessStats::KBookmarkAccessStats(const QString &bookmarksFile)
+    : m_fileName(fileName(bookmarksFile))
+    , m_loaded(false)
+    , m_readOffset(0)
+{
+}
+
+QString KBookmarkAccessStats::fileName(const QString &bookmarksFile)
+{
+    return bookmarksFile + QLatin1String(".stats");
+}
+
+bool KBookmarkAccessStats::isStatistic(const QString &key)
+{
+    return key == QLatin1String("visit_count") || key == QLatin1String("time_visited")
+           || key == QLatin1String("time_added");
+}
+
+bool KBookmarkAccessStats::value(const QString &id, const QString &key, QString *value)
+{
+    ensureLoaded();
+    QHash<QString, Entry>::const_iterator it = m_entries.constFind(id);
+    if (it == m_entries.constEnd()) {
+        return false;
+    }
+    if (key == QLatin1String("visit_count")) {
+        *value = QString::number(it.value().visitCount);
+    } else if (key == QLatin1String("time_visited")) {
+        *value = it.value().timeVisited;
+    } else if (key == QLatin1String("time_added")) {
+        *value = it.value().timeAdded;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool KBookmarkAccessStats::record(const QString &id, const Entry &entry)
+{
+    // One record per line, tab separated
+    if (id.isEmpty() || id.contains(QLatin1Char('\t')) || id.contains(QLatin1Char('\n'))) {
+        return false;
+    }
+    ensureLoaded();
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't write" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+    const QString line = id + QLatin1Char('\t') + entry.timeAdded + QLatin1Char('\t') + entry.timeVisited
+                         + QLatin1Char('\t') + QString::number(entry.visitCount) + QLatin1Char('\n');
+    // A single write, so that lines appended by several processes don't get mixed
+    if (file.write(line.toUtf8()) < 0) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't write" << m_fileName << ":" << file.errorString();
+        return false;
+    }
+    // The line is read again by the next refresh(), in the order of the file
+    m_entries.insert(id, entry);
+    return true;
+}
+
+bool KBookmarkAccessStats::setValue(const QString &id, const QString &key, const QString &value)
+{
+    ensureLoaded();
+    Entry entry = m_entries.value(id);
+    if (!m_entries.contains(id)) {
+        entry.visitCount = 0;
+    }
+    if (key == QLatin1String("visit_count")) {
+        entry.visitCount = value.toInt();
+    } else if (key == QLatin1String("time_visited")) {
+        entry.timeVisited = value;
+    } else if (key == QLatin1String("time_added")) {
+        entry.timeAdded = value;
+    } else {
+        return false;
+    }
+    return record(id, entry);
+}
+
+void KBookmarkAccessStats::refresh()
+{
+    if (!m_loaded) {
+        ensureLoaded();
+        return;
+    }
+    const qint64 size = QFileInfo(m_fileName).size();
+    if (size < m_readOffset) {
+        // Compacted by another process
+        m_entries.clear();
+        readFrom(0);
+    } else if (size > m_readOffset) {
+        readFrom(m_readOffset);
+    }
+}
+
+QHash<QString, KBookmarkAccessStats::Entry> KBookmarkAccessStats::entries()
+{
+    ensureLoaded();
+    return m_entries;
+}
+
+void KBookmarkAccessStats::discardRead()
+{
+    ensureLoaded();
+    QByteArray rest;
+    QFile file(m_fileName);
+    if (file.open(QIODevice::ReadOnly) && file.seek(m_readOffset)) {
+        rest = file.readAll();
+    }
+    file.close();
+    m_entries.clear();
+    m_readOffset = 0;
+
+    if (rest.isEmpty()) {
+        if (QFile::exists(m_fileName) && !QFile::remove(m_fileName)) {
+            qCWarning(KBOOKMARKS_LOG) << "Can't remove" << m_fileName;
+        }
+        return;
+    }
+    // Visits recorded by other processes while the values were moved to the XBEL file
+    QSaveFile newFile(m_fileName);
+    if (!newFile.open(QIODevice::WriteOnly) || newFile.write(rest) != rest.size() || !newFile.commit()) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't write" << m_fileName << ":" << newFile.errorString();
+    }
+    readFrom(0);
+}
+
+void KBookmarkAccessStats::ensureLoaded()
+{
+    if (!m_loaded) {
+        m_loaded = true;
+        readFrom(0);
+    }
+}
+
+void KBookmarkAccessStats::readFrom(qint64 offset)
+{
+    m_readOffset = offset;
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset)) {
+        return;
+    }
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine();
+        if (!line.endsWith('\n')) {
+            break; // still being written, read it next time
+        }
+        m_readOffset += line.size();
+        const QList<QByteArray> fields = line.left(line.size() - 1).split('\t');
+        bool ok = false;
+        Entry entry;
+        entry.visitCount = fields.count() == 4 ? fields.at(3).toInt(&ok) : 0;
+        if (!ok) {
+            qCWarning(KBOOKMARKS_LOG) << "Invalid line in" << m_fileName << ":" << line;
+            continue;
+        }
+        entry.timeAdded = QString::fromUtf8(fields.at(1));
+        entry.timeVisited = QString::fromUtf8(fields.at(2));
+        m_entries.insert(QString::fromUtf8(fields.at(0)), entry);
+    }
+}
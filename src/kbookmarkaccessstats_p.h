@@ -0,0 +1,95 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKACCESSSTATS_P_H
+#define KBOOKMARKACCESSSTATS_P_H
+
+#include <QHash>
+#include <QString>
+
+/**
+ * The access metadata of bookmarks (time_added, time_visited, visit_count,
+ * see KBookmark::updateAccessMetadata()), stored next to the bookmark file
+ * as "<file>.stats" so that visiting a page doesn't rewrite the bookmarks.
+ *
+ * Every visit appends a line with the new values of the bookmark, found by
+ * its "id" attribute; the last line for a bookmark wins. The values shadow
+ * the ones in the XBEL metadata until KBookmarkManager::compactAccessStatistics()
+ * writes them there and removes them from the file.
+ *
+ * The file is read on first use, and lines appended by other processes
+ * are read before recording a visit.
+ * @internal
+ */
+class KBookmarkAccessStats
+{
+public:
+    struct Entry {
+        QString timeAdded;
+        QString timeVisited;
+        int visitCount;
+    };
+
+    explicit KBookmarkAccessStats(const QString &bookmarksFile);
+
+    static QString fileName(const QString &bookmarksFile);
+    /**
+     * @return true for the metadata items stored here
+     */
+    static bool isStatistic(const QString &key);
+
+    /**
+     * @return the value of @p key for the bookmark @p id, if it was recorded here
+     */
+    bool value(const QString &id, const QString &key, QString *value);
+    /**
+     * Appends the new values of the bookmark @p id to the file
+     */
+    bool record(const QString &id, const Entry &entry);
+    /**
+     * Same as record(), changing only @p key in the values recorded for @p id
+     */
+    bool setValue(const QString &id, const QString &key, const QString &value);
+    /**
+     * Reads what other processes appended since the last time
+     */
+    void refresh();
+
+    /**
+     * @return all recorded values, by bookmark id
+     */
+    QHash<QString, Entry> entries();
+    /**
+     * Forgets the values read so far and removes their lines from the file,
+     * once they are in the XBEL file. Lines appended since are kept.
+     */
+    void discardRead();
+
+private:
+    void ensureLoaded();
+    void readFrom(qint64 offset);
+
+    QString m_fileName;
+    bool m_loaded;
+    qint64 m_readOffset; // where the lines not read yet start
+    QHash<QString, Entry> m_entries;
+};
+
+#endif
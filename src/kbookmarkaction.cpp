@@ -20,6 +20,7 @@
 
 #include "kbookmarkaction.h"
 #include "kbookmarkowner.h"
+#include "kbookmarkindex_p.h"
 #include <QDesktopServices>
 #include <QApplication>
 
@@ -30,7 +31,7 @@ KBookmarkAction::KBookmarkAction(const KBookmark &bk, KBookmarkOwner *owner, QOb
 {
     setIcon(QIcon::fromTheme(bookmark().icon()));
     setIconText(text());
-    setToolTip(bookmark().url().toDisplayString(QUrl::PreferLocalFile));
+    setToolTip(kbookmarkDisplayUrl(bookmark()));
     setStatusTip(toolTip());
     setWhatsThis(toolTip());
     const QString description = bk.description();
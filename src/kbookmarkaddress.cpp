@@ -0,0 +1,53 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarkaddress_p.h"
+
+KBookmarkAddress KBookmarkAddress::fromString(const QString &address)
+{
+    // Same splitting as the former address.split(QRegularExpression("[/+]"), QString::SkipEmptyParts)
+    KBookmarkAddress result;
+    const int length = address.length();
+    int start = 0;
+    for (int i = 0; i <= length; ++i) {
+        const QChar c = i < length ? address.at(i) : QChar();
+        if (i == length || c == QLatin1Char('/') || c == QLatin1Char('+')) {
+            if (i > start) {
+                result.m_positions.append(address.midRef(start, i - start).toUInt());
+            }
+            if (c == QLatin1Char('+')) {
+                result.m_append = true;
+            }
+            start = i + 1;
+        }
+    }
+    return result;
+}
+
+QString KBookmarkAddress::toString() const
+{
+    QString result;
+    for (int i = 0; i < m_positions.count(); ++i) {
+        result += QLatin1Char('/') + QString::number(m_positions.at(i));
+    }
+    if (m_append) {
+        result += QLatin1Char('+');
+    }
+    return result;
+}
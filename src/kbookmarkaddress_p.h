@@ -0,0 +1,64 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKADDRESS_P_H
+#define KBOOKMARKADDRESS_P_H
+
+#include <QString>
+#include <QVarLengthArray>
+
+/**
+ * A parsed bookmark address like "/5/10/2+" (see KBookmark::address()):
+ * the position at each level, plus whether it ended with a "+".
+ * @internal
+ */
+class KBookmarkAddress
+{
+public:
+    KBookmarkAddress()
+        : m_append(false)
+    {
+    }
+
+    static KBookmarkAddress fromString(const QString &address);
+    QString toString() const;
+
+    int depth() const
+    {
+        return m_positions.count();
+    }
+    int at(int level) const
+    {
+        return m_positions.at(level);
+    }
+    /**
+     * True for addresses ending with "+". findByAddress() has always
+     * resolved them like the address without the "+".
+     */
+    bool isAppend() const
+    {
+        return m_append;
+    }
+
+private:
+    QVarLengthArray<int, 8> m_positions;
+    bool m_append;
+};
+
+#endif
@@ -0,0 +1,172 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkbackup_p.h"
+#include "kbookmarks_debug.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+// Sorts like the times, and is valid in file names everywhere
+static const char s_timeFormat[] = "yyyy-MM-dd_HH-mm-ss.zzz";
+
+static QString backupPrefix(const QString &bookmarksFile)
+{
+    return bookmarksFile + QLatin1String(".bak-");
+}
+
+// What KBackup::simpleBackupFile() used to create
+static QString legacyBackupFile(const QString &bookmarksFile)
+{
+    return bookmarksFile + QLatin1String(".bak");
+}
+
+static bool cloneFile(const QString &source, const QString &target)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    QFile sourceFile(source);
+    QFile targetFile(target);
+    if (!sourceFile.open(QIODevice::ReadOnly) || !targetFile.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    if (::ioctl(targetFile.handle(), FICLONE, sourceFile.handle()) == 0) {
+        return true;
+    }
+    targetFile.close();
+    QFile::remove(target);
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(target);
+#endif
+    return false;
+}
+
+// Makes @p target a copy of @p source, without copying any data if possible
+static bool keepFile(const QString &source, const QString &target)
+{
+    // A bookmark file can be a symbolic link (e.g. into a synced folder): keep the
+    // file it points to, link() would make the backup a link to the link
+    QString file = QFileInfo(source).canonicalFilePath();
+    if (file.isEmpty()) {
+        file = source;
+    }
+    if (cloneFile(file, target)) {
+        return true;
+    }
+#ifdef Q_OS_UNIX
+    // The hard link shares the inode with the current version only until
+    // QSaveFile::commit() renames the new version over it, so it must not be
+    // taken any earlier, and must never be written into
+    if (::link(QFile::encodeName(file).constData(), QFile::encodeName(target).constData()) == 0) {
+        return true;
+    }
+#endif
+    return QFile::copy(file, target);
+}
+
+void KBookmarkBackup::backup(const QString &bookmarksFile, const Policy &policy)
+{
+    QStringList backups = list(bookmarksFile);
+    if (policy.isLegacy()) {
+        // Only the previous version, where older versions of this library and other tools expect it
+        const QString backupFile = legacyBackupFile(bookmarksFile);
+        if (QFile::exists(bookmarksFile)) {
+            QFile::remove(backupFile);
+            if (!keepFile(bookmarksFile, backupFile)) {
+                qCWarning(KBOOKMARKS_LOG) << "Could not back up" << bookmarksFile << "to" << backupFile;
+            }
+        }
+        for (const QString &backup : backups) {
+            if (!backup.endsWith(QLatin1String(".bak"))) {
+                QFile::remove(backup);
+            }
+        }
+        return;
+    }
+    // Left alone, it isn't one of the generations
+    if (!backups.isEmpty() && backups.last().endsWith(QLatin1String(".bak"))) {
+        backups.removeLast();
+    }
+
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    const bool due = backups.isEmpty() || policy.minInterval <= 0
+                     || time(backups.first()).secsTo(now) >= policy.minInterval;
+    if (policy.generations > 0 && due && QFile::exists(bookmarksFile)) {
+        const QString backupFile = backupPrefix(bookmarksFile) + now.toString(QLatin1String(s_timeFormat));
+        if (backups.contains(backupFile)) {
+            // Taken within the same millisecond
+        } else if (keepFile(bookmarksFile, backupFile)) {
+            backups.prepend(backupFile);
+        } else {
+            qCWarning(KBOOKMARKS_LOG) << "Could not back up" << bookmarksFile << "to" << backupFile;
+        }
+    }
+
+    for (int i = 0; i < backups.count(); ++i) {
+        // The newest backup is kept regardless of its age
+        const bool tooOld = i > 0 && policy.maxAge > 0 && time(backups.at(i)).daysTo(now) > policy.maxAge;
+        if (i >= policy.generations || tooOld) {
+            QFile::remove(backups.at(i));
+        }
+    }
+}
+
+QStringList KBookmarkBackup::list(const QString &bookmarksFile)
+{
+    QStringList backups;
+    if (bookmarksFile.isEmpty()) {
+        return backups;
+    }
+    const QFileInfo info(bookmarksFile);
+    const QDir dir = info.absoluteDir();
+    const QStringList names = dir.entryList(QStringList(info.fileName() + QLatin1String(".bak-*")),
+                                            QDir::Files | QDir::Hidden, QDir::Name | QDir::Reversed);
+    for (const QString &name : names) {
+        const QString backupFile = dir.absoluteFilePath(name);
+        if (time(backupFile).isValid()) {
+            backups.append(backupFile);
+        }
+    }
+    const QString legacyFile = legacyBackupFile(info.absoluteFilePath());
+    if (QFile::exists(legacyFile)) {
+        backups.append(legacyFile);
+    }
+    return backups;
+}
+
+QDateTime KBookmarkBackup::time(const QString &backupFile)
+{
+    const int pos = backupFile.lastIndexOf(QLatin1String(".bak-"));
+    if (pos < 0) {
+        return QFileInfo(backupFile).lastModified();
+    }
+    QDateTime time = QDateTime::fromString(backupFile.mid(pos + 5), QLatin1String(s_timeFormat));
+    time.setTimeSpec(Qt::UTC);
+    return time;
+}
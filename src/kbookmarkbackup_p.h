@@ -0,0 +1,80 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKBACKUP_P_H
+#define KBOOKMARKBACKUP_P_H
+
+#include <QDateTime>
+#include <QStringList>
+
+/**
+ * Backups of a bookmark file, see KBookmarkManager::setBackupGenerations().
+ *
+ * By default, the previous version is kept as "<file>.bak", as in older
+ * versions. Keeping more generations, or taking them at a minimum interval,
+ * stores them as "<file>.bak-<UTC time>" instead, and leaves "<file>.bak" alone.
+ *
+ * A backup is taken right before the file gets replaced by a QSaveFile,
+ * without copying it where possible: a copy-on-write clone (FICLONE) on
+ * file systems supporting it, or else a hard link to the old version,
+ * which QSaveFile::commit() replaces by a new file instead of writing into it.
+ * @internal
+ */
+class KBookmarkBackup
+{
+public:
+    struct Policy {
+        Policy()
+            : generations(1)
+            , maxAge(0)
+            , minInterval(0)
+        {
+        }
+        /**
+         * @return true for the default policy, using "<file>.bak"
+         */
+        bool isLegacy() const
+        {
+            return generations == 1 && minInterval == 0;
+        }
+        int generations; // how many backups are kept, 0 for none
+        int maxAge;      // in days, 0 for no limit
+        int minInterval; // in seconds between two backups
+    };
+
+    /**
+     * Keeps the current version of @p bookmarksFile as a backup if @p policy
+     * asks for one, and removes the backups @p policy doesn't keep anymore.
+     */
+    static void backup(const QString &bookmarksFile, const Policy &policy);
+
+    /**
+     * @return the backups of @p bookmarksFile, the newest first. The ".bak"
+     * file of older versions, if any, comes last.
+     */
+    static QStringList list(const QString &bookmarksFile);
+
+    /**
+     * @return when @p backupFile was taken
+     */
+    static QDateTime time(const QString &backupFile);
+};
+
+#endif
@@ -0,0 +1,251 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarkbinarycache_p.h"
+#include "kbookmarks_debug.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+
+#include <string.h>
+
+namespace
+{
+enum {
+    CacheMagic = 0x4b424d43, // "KBMC"
+    CacheVersion = 1
+};
+
+// Followed by the string table (stringCount StringEntry), the string data
+// (stringDataSize UTF-16 code units, padded to 4 bytes), the nodes and the attributes.
+struct CacheHeader {
+    quint32 magic;
+    quint32 version;
+    qint64 sourceSize;
+    qint64 sourceModified; // msecs since epoch
+    char sourceHash[20];
+    quint32 stringCount;
+    quint32 stringDataSize;
+    quint32 nodeCount;
+    quint32 attributeCount;
+};
+
+struct StringEntry {
+    quint32 offset;
+    quint32 length;
+};
+
+qint64 paddedStringDataSize(quint32 stringDataSize)
+{
+    return (qint64(stringDataSize) * 2 + 3) & ~qint64(3);
+}
+
+bool isValidIndex(qint32 index, quint32 count)
+{
+    return index >= -1 && index < qint32(count);
+}
+
+// Every tree walk follows firstChild and nextSibling, or parent upwards: the
+// first two must point to a later node and the parent to an earlier one, so
+// that no walk can loop, and each link must match the one pointing back to it.
+// The tree is append only, so this is how a valid one is always laid out.
+bool isValidStructure(const QVector<KBookmarkTree::Node> &nodes)
+{
+    for (int i = 0; i < nodes.count(); ++i) {
+        const KBookmarkTree::Node &node = nodes.at(i);
+        if (node.type > KBookmarkTree::CommentNode || node.bookmarkType > KBookmarkTree::SeparatorType
+                || (node.type != KBookmarkTree::ElementNode
+                    && (node.bookmarkType != KBookmarkTree::NoBookmark || node.firstChild != -1 || node.attributeCount != 0))) {
+            return false;
+        }
+        if (i == 0) {
+            if (node.parent != -1 || node.nextSibling != -1 || node.previousSibling != -1) {
+                return false;
+            }
+        } else if (node.parent < 0 || node.parent >= i) {
+            return false;
+        }
+
+        if (node.firstChild == -1) {
+            if (node.lastChild != -1) {
+                return false;
+            }
+        } else if (node.firstChild <= i || node.lastChild < node.firstChild
+                   || nodes.at(node.firstChild).parent != i || nodes.at(node.firstChild).previousSibling != -1
+                   || nodes.at(node.lastChild).parent != i || nodes.at(node.lastChild).nextSibling != -1) {
+            return false;
+        }
+
+        if (node.nextSibling != -1
+                && (node.nextSibling <= i || nodes.at(node.nextSibling).parent != node.parent
+                    || nodes.at(node.nextSibling).previousSibling != i)) {
+            return false;
+        }
+        // The parent lists the node: either as its first child, or through the previous sibling
+        if (node.previousSibling == -1) {
+            if (i != 0 && nodes.at(node.parent).firstChild != i) {
+                return false;
+            }
+        } else if (node.previousSibling >= i || nodes.at(node.previousSibling).nextSibling != i) {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+QString KBookmarkBinaryCache::fileName(const QString &bookmarksFile)
+{
+    return bookmarksFile + QLatin1String(".cache");
+}
+
+bool KBookmarkBinaryCache::read(const QString &bookmarksFile, const QByteArray &sourceHash, KBookmarkTree *tree)
+{
+    QFile file(fileName(bookmarksFile));
+    if (!file.open(QIODevice::ReadOnly) || file.size() < qint64(sizeof(CacheHeader))) {
+        return false;
+    }
+    const qint64 size = file.size();
+    const uchar *data = file.map(0, size);
+    if (!data) {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    const QFileInfo source(bookmarksFile);
+    if (header.magic != CacheMagic || header.version != CacheVersion
+            || header.sourceSize != source.size()
+            || header.sourceModified != source.lastModified().toMSecsSinceEpoch()
+            || sourceHash.size() != int(sizeof(header.sourceHash))
+            || memcmp(header.sourceHash, sourceHash.constData(), sizeof(header.sourceHash)) != 0) {
+        return false;
+    }
+
+    const qint64 stringTableOffset = sizeof(CacheHeader);
+    const qint64 stringDataOffset = stringTableOffset + qint64(header.stringCount) * sizeof(StringEntry);
+    const qint64 nodesOffset = stringDataOffset + paddedStringDataSize(header.stringDataSize);
+    const qint64 attributesOffset = nodesOffset + qint64(header.nodeCount) * sizeof(KBookmarkTree::Node);
+    const qint64 end = attributesOffset + qint64(header.attributeCount) * sizeof(KBookmarkTree::Attribute);
+    if (end != size || header.stringCount == 0 || header.nodeCount == 0) {
+        qCWarning(KBOOKMARKS_LOG) << "Ignoring corrupted bookmark cache" << file.fileName();
+        return false;
+    }
+
+    KBookmarkTree result;
+    const StringEntry *entries = reinterpret_cast<const StringEntry *>(data + stringTableOffset);
+    const QChar *stringData = reinterpret_cast<const QChar *>(data + stringDataOffset);
+    result.m_strings.m_strings.resize(header.stringCount);
+    result.m_strings.m_ids.reserve(header.stringCount);
+    for (quint32 i = 1; i < header.stringCount; ++i) { // 0 is the empty string
+        if (quint64(entries[i].offset) + entries[i].length > header.stringDataSize) {
+            qCWarning(KBOOKMARKS_LOG) << "Ignoring corrupted bookmark cache" << file.fileName();
+            return false;
+        }
+        // A real copy: the strings end up in the DOM, which outlives the mapping
+        const QString string(stringData + entries[i].offset, entries[i].length);
+        result.m_strings.m_strings[i] = string;
+        result.m_strings.m_ids.insert(string, i);
+    }
+
+    result.m_nodes.resize(header.nodeCount);
+    memcpy(result.m_nodes.data(), data + nodesOffset, header.nodeCount * sizeof(KBookmarkTree::Node));
+    result.m_attributes.resize(header.attributeCount);
+    memcpy(result.m_attributes.data(), data + attributesOffset, header.attributeCount * sizeof(KBookmarkTree::Attribute));
+    file.unmap(const_cast<uchar *>(data));
+
+    // Never trust indexes read from disk
+    const QVector<KBookmarkTree::Node> &nodes = result.m_nodes;
+    for (const KBookmarkTree::Node &node : nodes) {
+        if (!isValidIndex(node.parent, header.nodeCount) || !isValidIndex(node.firstChild, header.nodeCount)
+                || !isValidIndex(node.lastChild, header.nodeCount) || !isValidIndex(node.nextSibling, header.nodeCount)
+                || !isValidIndex(node.previousSibling, header.nodeCount)
+                || node.name < 0 || quint32(node.name) >= header.stringCount
+                || node.firstAttribute < 0 || node.attributeCount < 0
+                || quint64(node.firstAttribute) + quint64(node.attributeCount) > header.attributeCount) {
+            qCWarning(KBOOKMARKS_LOG) << "Ignoring corrupted bookmark cache" << file.fileName();
+            return false;
+        }
+    }
+    const QVector<KBookmarkTree::Attribute> &attributes = result.m_attributes;
+    for (const KBookmarkTree::Attribute &attribute : attributes) {
+        if (attribute.name < 0 || quint32(attribute.name) >= header.stringCount
+                || attribute.value < 0 || quint32(attribute.value) >= header.stringCount) {
+            qCWarning(KBOOKMARKS_LOG) << "Ignoring corrupted bookmark cache" << file.fileName();
+            return false;
+        }
+    }
+    if (!isValidStructure(nodes)) {
+        qCWarning(KBOOKMARKS_LOG) << "Ignoring corrupted bookmark cache" << file.fileName();
+        return false;
+    }
+
+    *tree = result;
+    return true;
+}
+
+bool KBookmarkBinaryCache::write(const QString &bookmarksFile, const QByteArray &sourceHash, const KBookmarkTree &tree)
+{
+    const QFileInfo source(bookmarksFile);
+    if (tree.isEmpty() || !source.exists() || sourceHash.size() != int(sizeof(CacheHeader::sourceHash))) {
+        return false;
+    }
+
+    const QVector<QString> &strings = tree.m_strings.m_strings;
+    QVector<StringEntry> entries(strings.count());
+    quint32 stringDataSize = 0;
+    for (int i = 0; i < strings.count(); ++i) {
+        entries[i].offset = stringDataSize;
+        entries[i].length = strings.at(i).size();
+        stringDataSize += strings.at(i).size();
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CacheMagic;
+    header.version = CacheVersion;
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+    memcpy(header.sourceHash, sourceHash.constData(), sizeof(header.sourceHash));
+    header.stringCount = strings.count();
+    header.stringDataSize = stringDataSize;
+    header.nodeCount = tree.m_nodes.count();
+    header.attributeCount = tree.m_attributes.count();
+
+    QSaveFile file(fileName(bookmarksFile));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.constData()), entries.count() * sizeof(StringEntry));
+    for (const QString &string : strings) {
+        file.write(reinterpret_cast<const char *>(string.constData()), string.size() * 2);
+    }
+    const qint64 padding = paddedStringDataSize(stringDataSize) - qint64(stringDataSize) * 2;
+    file.write(QByteArray(int(padding), '\0'));
+    file.write(reinterpret_cast<const char *>(tree.m_nodes.constData()), tree.m_nodes.count() * sizeof(KBookmarkTree::Node));
+    file.write(reinterpret_cast<const char *>(tree.m_attributes.constData()), tree.m_attributes.count() * sizeof(KBookmarkTree::Attribute));
+    if (!file.commit()) {
+        qCWarning(KBOOKMARKS_LOG) << "Could not write the bookmark cache" << file.fileName() << file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKBINARYCACHE_P_H
+#define KBOOKMARKBINARYCACHE_P_H
+
+#include "kbookmarktree_p.h"
+
+/**
+ * A binary snapshot of a parsed bookmark file, stored next to it as
+ * "<file>.cache": the string, node and attribute tables of KBookmarkTree.
+ * Loading it copies the node and attribute tables as they are and builds the
+ * strings from the table, which is much cheaper than parsing XML, but it is
+ * still a copy: the tree is not used in place from the file.
+ *
+ * The XBEL file stays the reference, the cache is only used when the size,
+ * modification time and SHA-1 of the file match the ones it was created
+ * from, and it is simply rewritten otherwise.
+ * @internal
+ */
+class KBookmarkBinaryCache
+{
+public:
+    static QString fileName(const QString &bookmarksFile);
+
+    /**
+     * Loads the cache of @p bookmarksFile into @p tree
+     * @param sourceHash the SHA-1 of the current contents of @p bookmarksFile
+     * @return false if there is no valid cache for these contents
+     */
+    static bool read(const QString &bookmarksFile, const QByteArray &sourceHash, KBookmarkTree *tree);
+
+    /**
+     * Writes the cache of @p bookmarksFile, which was just parsed into or written from @p tree
+     */
+    static bool write(const QString &bookmarksFile, const QByteArray &sourceHash, const KBookmarkTree &tree);
+};
+
+#endif
@@ -21,6 +21,7 @@
 #include "kbookmarkdombuilder.h"
 #include "kbookmarks_debug.h"
 #include <kbookmarkmanager.h>
+#include "kbookmarkindex_p.h"
 
 KBookmarkDomBuilder::KBookmarkDomBuilder(
     const KBookmarkGroup &bkGroup, KBookmarkManager *manager
@@ -58,7 +59,7 @@ void KBookmarkDomBuilder::newBookmark(
                            QUrl(url),
                            QString());
         // store additional info
-        bk.internalElement().setAttribute(QStringLiteral("netscapeinfo"), additionalInfo);
+        kbookmarkSetAttribute(bk, QStringLiteral("netscapeinfo"), additionalInfo);
     } else {
         qCWarning(KBOOKMARKS_LOG) << "m_stack is empty. This should not happen when importing a valid bookmarks file!";
     }
@@ -74,9 +75,8 @@ void KBookmarkDomBuilder::newFolder(
         m_list.append(gp);
         m_stack.push(m_list.last());
         // store additional info
-        QDomElement element = m_list.last().internalElement();
-        element.setAttribute(QStringLiteral("netscapeinfo"), additionalInfo);
-        element.setAttribute(QStringLiteral("folded"), (open ? "no" : "yes"));
+        kbookmarkSetAttribute(gp, QStringLiteral("netscapeinfo"), additionalInfo);
+        kbookmarkSetAttribute(gp, QStringLiteral("folded"), open ? QStringLiteral("no") : QStringLiteral("yes"));
     } else {
         qCWarning(KBOOKMARKS_LOG) << "m_stack is empty. This should not happen when importing a valid bookmarks file!";
     }
@@ -23,6 +23,7 @@
 #include "kbookmarkimporter.h"
 #include "kbookmarkexporter.h"
 #include "kbookmarkmanager.h"
+#include "kbookmarkindex_p.h"
 #include <QFileDialog>
 #include <QMessageBox>
 #include "kbookmarks_debug.h"
@@ -181,7 +182,7 @@ QString KNSBookmarkExporterImpl::folderAsString(const KBookmarkGroup &parent) co
         if (bk.isGroup()) {
             fstream << "<DT><H3 "
                     << (!bk.toGroup().isOpen() ? "FOLDED " : "")
-                    << bk.internalElement().attribute(QStringLiteral("netscapeinfo")) << ">"
+                    << kbookmarkElement(bk).attribute(QStringLiteral("netscapeinfo")) << ">"
                     << text << "</H3>" << endl
                     << "<DL><P>" << endl
                     << folderAsString(bk.toGroup())
@@ -191,7 +192,7 @@ QString KNSBookmarkExporterImpl::folderAsString(const KBookmarkGroup &parent) co
         } else {
             // note - netscape seems to use local8bit for url...
             fstream << "<DT><A HREF=\"" << bk.url().toString() << "\""
-                    << bk.internalElement().attribute(QStringLiteral("netscapeinfo")) << ">"
+                    << kbookmarkElement(bk).attribute(QStringLiteral("netscapeinfo")) << ">"
                     << text << "</A>" << endl;
             continue;
         }
@@ -0,0 +1,769 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarkindex_p.h"
+#include "kbookmark.h"
+
+#include <QReadWriteLock>
+#include <QUuid>
+#include <kstringhandler.h>
+
+namespace
+{
+// QDomNode has no public identity, but its d-pointer is one.
+// Forming a pointer to the protected member through a subclass is allowed,
+// using it on a plain QDomNode then doesn't need any access.
+class DomNodeAccess : public QDomNode
+{
+public:
+    static quintptr key(const QDomNode &node)
+    {
+        return reinterpret_cast<quintptr>(node.*(&DomNodeAccess::impl));
+    }
+};
+
+// Same trick for the element wrapped by KBookmark
+class BookmarkAccess : public KBookmark
+{
+public:
+    static QDomElement elementOf(const KBookmark &bookmark)
+    {
+        return bookmark.*(&BookmarkAccess::element);
+    }
+};
+
+class KBookmarkIndexRegistry
+{
+public:
+    QReadWriteLock lock;
+    QHash<quintptr, KBookmarkIndex *> indexes;
+};
+}
+
+Q_GLOBAL_STATIC(KBookmarkIndexRegistry, s_registry)
+
+quintptr kbookmarkNodeKey(const QDomNode &node)
+{
+    return DomNodeAccess::key(node);
+}
+
+QDomElement kbookmarkElement(const KBookmark &bookmark)
+{
+    return BookmarkAccess::elementOf(bookmark);
+}
+
+void kbookmarkSetAttribute(const KBookmark &bookmark, const QString &name, const QString &value)
+{
+    QDomElement element = BookmarkAccess::elementOf(bookmark);
+    element.setAttribute(name, value);
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        index->fieldsChanged(element);
+        index->documentChanged();
+        if (index->opLog().isEnabled()) {
+            index->opLog().recordUpdate(element);
+        }
+    }
+}
+
+QString kbookmarkDisplayUrl(const KBookmark &bookmark)
+{
+    const QDomElement element = BookmarkAccess::elementOf(bookmark);
+    if (KBookmarkIndex *index = KBookmarkIndex::forNode(element)) {
+        return index->displayUrl(element);
+    }
+    return bookmark.url().toDisplayString(QUrl::PreferLocalFile);
+}
+
+// Bookmarks store their href in various encodings (see KBookmark::setUrl() and
+// KBookmarkGroup::addBookmark()), compare them in one form
+static QString urlKey(const QUrl &url)
+{
+    return url.toString(QUrl::FullyEncoded);
+}
+
+static QString hrefKey(const QDomElement &bookmark)
+{
+    return urlKey(QUrl(bookmark.attribute(QStringLiteral("href"))));
+}
+
+static bool isKnownTag(const QDomElement &elem)
+{
+    const QString tag = elem.tagName();
+    return tag == QLatin1String("folder") || tag == QLatin1String("bookmark")
+           || tag == QLatin1String("separator");
+}
+
+KBookmarkIndex::KBookmarkIndex()
+    : m_documentKey(0)
+    , m_structureGeneration(0)
+    , m_generation(0)
+    , m_urlsBuilt(false)
+    , m_idsBuilt(false)
+    , m_iconCacheHits(0)
+    , m_iconCacheMisses(0)
+    , m_directAccess(false)
+    , m_accessStats(nullptr)
+{
+}
+
+KBookmarkIndex::~KBookmarkIndex()
+{
+    setDocument(QDomDocument());
+}
+
+void KBookmarkIndex::setDocument(const QDomDocument &doc)
+{
+    const quintptr key = kbookmarkNodeKey(doc);
+    if (key == m_documentKey) {
+        return;
+    }
+    if (!s_registry.isDestroyed()) {
+        QWriteLocker locker(&s_registry()->lock);
+        if (m_documentKey) {
+            s_registry()->indexes.remove(m_documentKey);
+        }
+        if (key) {
+            s_registry()->indexes.insert(key, this);
+        }
+    }
+    m_document = doc;
+    m_documentKey = key;
+    clear();
+}
+
+KBookmarkIndex *KBookmarkIndex::forNode(const QDomNode &node)
+{
+    if (node.isNull() || !s_registry.exists() || s_registry.isDestroyed()) {
+        return nullptr;
+    }
+    QReadLocker locker(&s_registry()->lock);
+    if (s_registry()->indexes.isEmpty()) {
+        return nullptr;
+    }
+    return s_registry()->indexes.value(kbookmarkNodeKey(node.ownerDocument()));
+}
+
+const KBookmarkIndex::GroupEntry &KBookmarkIndex::groupEntry(const QDomElement &group)
+{
+    const quintptr key = kbookmarkNodeKey(group);
+    QHash<quintptr, GroupEntry>::iterator it = m_groups.find(key);
+    if (it == m_groups.end()) {
+        loadGroup(group);
+        GroupEntry entry;
+        entry.group = group;
+        int position = 0;
+        for (QDomElement e = group.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            if (isKnownTag(e)) {
+                entry.positions.insert(kbookmarkNodeKey(e), position++);
+                entry.children.append(e);
+            }
+        }
+        it = m_groups.insert(key, entry);
+    }
+    return it.value();
+}
+
+int KBookmarkIndex::position(const QDomElement &group, const QDomElement &child)
+{
+    QMutexLocker locker(&m_mutex);
+    return groupEntry(group).positions.value(kbookmarkNodeKey(child), -1);
+}
+
+QDomElement KBookmarkIndex::child(const QDomElement &group, int position)
+{
+    QMutexLocker locker(&m_mutex);
+    const QVector<QDomElement> &children = groupEntry(group).children;
+    return position >= 0 && position < children.count() ? children.at(position) : QDomElement();
+}
+
+int KBookmarkIndex::childCount(const QDomElement &group)
+{
+    QMutexLocker locker(&m_mutex);
+    return groupEntry(group).children.count();
+}
+
+quint64 KBookmarkIndex::structureGeneration() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_structureGeneration;
+}
+
+quint64 KBookmarkIndex::generation() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_generation;
+}
+
+void KBookmarkIndex::documentChanged()
+{
+    QMutexLocker locker(&m_mutex);
+    ++m_generation;
+}
+
+void KBookmarkIndex::invalidateGroup(const QDomElement &group)
+{
+    QMutexLocker locker(&m_mutex);
+    m_groups.remove(kbookmarkNodeKey(group));
+    dropSnapshotPath(group);
+    ++m_structureGeneration;
+}
+
+void KBookmarkIndex::insertUrls(const QDomElement &elem)
+{
+    const QString tag = elem.tagName();
+    if (tag == QLatin1String("bookmark")) {
+        QVector<QDomElement> &bookmarks = m_urls[hrefKey(elem)];
+        if (!bookmarks.contains(elem)) { // moved within the document
+            bookmarks.append(elem);
+        }
+    } else if (tag == QLatin1String("folder") || tag == QLatin1String("xbel")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            insertUrls(e);
+        }
+    }
+}
+
+void KBookmarkIndex::removeUrls(const QDomElement &elem)
+{
+    const QString tag = elem.tagName();
+    if (tag == QLatin1String("bookmark")) {
+        QHash<QString, QVector<QDomElement> >::iterator it = m_urls.find(hrefKey(elem));
+        if (it != m_urls.end()) {
+            it.value().removeAll(elem);
+            if (it.value().isEmpty()) {
+                m_urls.erase(it);
+            }
+        }
+    } else if (tag == QLatin1String("folder")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            removeUrls(e);
+        }
+    }
+}
+
+// Applications can still change the DOM behind our back using KBookmark::internalElement(),
+// so check that an indexed bookmark is still one, with the same URL, in this document.
+bool KBookmarkIndex::isIndexedBookmark(const QDomElement &elem, const QString &urlKey) const
+{
+    if (elem.tagName() != QLatin1String("bookmark") || hrefKey(elem) != urlKey) {
+        return false;
+    }
+    return isInDocument(elem);
+}
+
+bool KBookmarkIndex::isInDocument(const QDomElement &elem) const
+{
+    QDomNode node = elem;
+    while (!node.parentNode().isNull()) {
+        node = node.parentNode();
+    }
+    return kbookmarkNodeKey(node) == m_documentKey;
+}
+
+QList<QDomElement> KBookmarkIndex::bookmarksForUrl(const QUrl &url)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_urlsBuilt) {
+        m_urlsBuilt = true;
+        loadAllGroups();
+        insertUrls(m_document.documentElement());
+    }
+    const QString key = urlKey(url);
+    QHash<QString, QVector<QDomElement> >::iterator it = m_urls.find(key);
+    if (it == m_urls.end()) {
+        return QList<QDomElement>();
+    }
+    QVector<QDomElement> &bookmarks = it.value();
+    for (int i = bookmarks.count() - 1; i >= 0; --i) {
+        if (!isIndexedBookmark(bookmarks.at(i), key)) {
+            bookmarks.remove(i);
+        }
+    }
+    if (bookmarks.isEmpty()) {
+        m_urls.erase(it);
+        return QList<QDomElement>();
+    }
+    return bookmarks.toList();
+}
+
+void KBookmarkIndex::bookmarksAdded(const QDomElement &subtree)
+{
+    QVector<QDomElement> renamed;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_urlsBuilt) {
+            insertUrls(subtree);
+        }
+        if (m_idsBuilt) {
+            insertIds(subtree, &renamed);
+        }
+    }
+    recordRenamed(renamed);
+}
+
+void KBookmarkIndex::bookmarksRemoved(const QDomElement &subtree)
+{
+    QMutexLocker locker(&m_mutex);
+    dropShallowFolders(subtree);
+    if (!m_fields.isEmpty()) {
+        removeFields(subtree);
+    }
+    if (m_urlsBuilt) {
+        removeUrls(subtree);
+    }
+    if (m_idsBuilt) {
+        removeIds(subtree);
+    }
+    if (!m_snapshotNodes.isEmpty()) {
+        removeSnapshotNodes(subtree);
+    }
+}
+
+void KBookmarkIndex::insertIds(const QDomElement &elem, QVector<QDomElement> *renamed)
+{
+    const QString tag = elem.tagName();
+    if (tag == QLatin1String("folder") || tag == QLatin1String("bookmark")) {
+        const QString id = elem.attribute(QStringLiteral("id"));
+        if (!id.isEmpty()) {
+            QDomElement &indexed = m_ids[id];
+            if (indexed.isNull() || indexed == elem || indexed.attribute(QStringLiteral("id")) != id
+                    || !isInDocument(indexed)) {
+                indexed = elem;
+            } else {
+                // A copy, e.g. pasted from the same document
+                QDomElement copy = elem;
+                const QString newId = createId();
+                copy.setAttribute(QStringLiteral("id"), newId);
+                m_ids.insert(newId, copy);
+                dropSnapshotPath(copy);
+                ++m_generation;
+                renamed->append(copy);
+            }
+        }
+    }
+    if (tag == QLatin1String("folder") || tag == QLatin1String("xbel")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            insertIds(e, renamed);
+        }
+    }
+}
+
+void KBookmarkIndex::removeIds(const QDomElement &elem)
+{
+    const QString tag = elem.tagName();
+    if (tag == QLatin1String("folder") || tag == QLatin1String("bookmark")) {
+        QHash<QString, QDomElement>::iterator it = m_ids.find(elem.attribute(QStringLiteral("id")));
+        if (it != m_ids.end() && it.value() == elem) {
+            m_ids.erase(it);
+        }
+    }
+    if (tag == QLatin1String("folder")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            removeIds(e);
+        }
+    }
+}
+
+// Called without the lock, as recording them looks up the addresses
+void KBookmarkIndex::recordRenamed(const QVector<QDomElement> &renamed)
+{
+    for (int i = 0; i < renamed.count(); ++i) {
+        m_opLog.recordUpdate(renamed.at(i));
+    }
+}
+
+QDomElement KBookmarkIndex::elementForId(const QString &id)
+{
+    QVector<QDomElement> renamed;
+    QDomElement result;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_idsBuilt) {
+            m_idsBuilt = true;
+            loadAllGroups();
+            insertIds(m_document.documentElement(), &renamed);
+        }
+        QHash<QString, QDomElement>::iterator it = m_ids.find(id);
+        if (it != m_ids.end()) {
+            // Changed behind our back through the DOM?
+            if (it.value().attribute(QStringLiteral("id")) == id && isInDocument(it.value())) {
+                result = it.value();
+            } else {
+                m_ids.erase(it);
+            }
+        }
+    }
+    recordRenamed(renamed);
+    return result;
+}
+
+void KBookmarkIndex::idAssigned(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    const QString id = element.attribute(QStringLiteral("id"));
+    if (m_idsBuilt && !id.isEmpty()) {
+        m_ids.insert(id, element);
+    }
+    dropSnapshotPath(element);
+}
+
+QString KBookmarkIndex::createId()
+{
+    // XML ids can't start with a digit
+    return QLatin1String("kbookmark-") + QUuid::createUuid().toString().mid(1, 36);
+}
+
+void KBookmarkIndex::urlChanged(const QDomElement &bookmark, const QString &oldHref)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_urlsBuilt) {
+        return;
+    }
+    QHash<QString, QVector<QDomElement> >::iterator it = m_urls.find(urlKey(QUrl(oldHref)));
+    if (it != m_urls.end() && it.value().removeAll(bookmark) > 0) {
+        if (it.value().isEmpty()) {
+            m_urls.erase(it);
+        }
+        insertUrls(bookmark);
+    }
+}
+
+KBookmarkIndex::FieldEntry &KBookmarkIndex::fieldEntry(const QDomElement &element)
+{
+    FieldEntry &entry = m_fields[kbookmarkNodeKey(element)];
+    if (entry.element.isNull()) {
+        entry.element = element;
+    }
+    return entry;
+}
+
+QUrl KBookmarkIndex::url(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    FieldEntry &entry = fieldEntry(element);
+    if (!(entry.fields & FieldEntry::Url)) {
+        entry.url = QUrl(element.attribute(QStringLiteral("href")));
+        entry.fields |= FieldEntry::Url;
+    }
+    return entry.url;
+}
+
+QString KBookmarkIndex::text(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    FieldEntry &entry = fieldEntry(element);
+    if (!(entry.fields & FieldEntry::Text)) {
+        entry.text = KStringHandler::csqueeze(KBookmark(element).fullText());
+        entry.fields |= FieldEntry::Text;
+    }
+    return entry.text;
+}
+
+QString KBookmarkIndex::displayUrl(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    FieldEntry &entry = fieldEntry(element);
+    if (!(entry.fields & FieldEntry::DisplayUrl)) {
+        if (!(entry.fields & FieldEntry::Url)) {
+            entry.url = QUrl(element.attribute(QStringLiteral("href")));
+            entry.fields |= FieldEntry::Url;
+        }
+        entry.displayUrl = entry.url.toDisplayString(QUrl::PreferLocalFile);
+        entry.fields |= FieldEntry::DisplayUrl;
+    }
+    return entry.displayUrl;
+}
+
+bool KBookmarkIndex::cachedMetaDataItem(const QDomElement &element, int atom, QDomElement *item)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<quintptr, FieldEntry>::const_iterator it = m_fields.constFind(kbookmarkNodeKey(element));
+    if (it == m_fields.constEnd()) {
+        return false;
+    }
+    QHash<int, QDomElement>::const_iterator itemIt = it.value().metaDataItems.constFind(atom);
+    if (itemIt == it.value().metaDataItems.constEnd()) {
+        return false;
+    }
+    *item = itemIt.value();
+    return true;
+}
+
+void KBookmarkIndex::insertMetaDataItem(const QDomElement &element, int atom, const QDomElement &item)
+{
+    QMutexLocker locker(&m_mutex);
+    fieldEntry(element).metaDataItems.insert(atom, item);
+}
+
+int KBookmarkIndex::metaDataAtom(const QString &owner, const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_metaDataAtoms.intern(owner + QLatin1Char('\n') + key);
+}
+
+void KBookmarkIndex::fieldsChanged(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    m_fields.remove(kbookmarkNodeKey(element));
+    dropSnapshotPath(element);
+    ++m_generation;
+}
+
+void KBookmarkIndex::invalidateAll()
+{
+    QMutexLocker locker(&m_mutex);
+    m_groups.clear();
+    m_fields.clear();
+    m_snapshotNodes.clear();
+    ++m_structureGeneration;
+    ++m_generation;
+}
+
+void KBookmarkIndex::removeFields(const QDomElement &elem)
+{
+    m_fields.remove(kbookmarkNodeKey(elem));
+    if (elem.tagName() == QLatin1String("folder")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            removeFields(e);
+        }
+    }
+}
+
+bool KBookmarkIndex::cachedSnapshotNode(const QDomElement &element, KBookmarkSnapshotNode::Ptr *node)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<quintptr, SnapshotEntry>::const_iterator it = m_snapshotNodes.constFind(kbookmarkNodeKey(element));
+    if (it == m_snapshotNodes.constEnd()) {
+        return false;
+    }
+    *node = it.value().node;
+    return true;
+}
+
+void KBookmarkIndex::insertSnapshotNode(const QDomElement &element, const KBookmarkSnapshotNode::Ptr &node)
+{
+    QMutexLocker locker(&m_mutex);
+    SnapshotEntry &entry = m_snapshotNodes[kbookmarkNodeKey(element)];
+    entry.element = element;
+    entry.node = node;
+}
+
+// The snapshot node of node is outdated, and so are the ones of its parents
+void KBookmarkIndex::dropSnapshotPath(const QDomNode &node)
+{
+    if (m_snapshotNodes.isEmpty()) {
+        return;
+    }
+    for (QDomNode n = node; !n.isNull(); n = n.parentNode()) {
+        m_snapshotNodes.remove(kbookmarkNodeKey(n));
+    }
+}
+
+void KBookmarkIndex::removeSnapshotNodes(const QDomElement &elem)
+{
+    m_snapshotNodes.remove(kbookmarkNodeKey(elem));
+    if (elem.tagName() == QLatin1String("folder")) {
+        for (QDomElement e = elem.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            removeSnapshotNodes(e);
+        }
+    }
+}
+
+bool KBookmarkIndex::cachedIcon(const QString &key, QString *icon)
+{
+    QMutexLocker locker(&m_mutex);
+    QHash<QString, QString>::const_iterator it = m_icons.constFind(key);
+    if (it == m_icons.constEnd()) {
+        ++m_iconCacheMisses;
+        return false;
+    }
+    ++m_iconCacheHits;
+    *icon = it.value();
+    return true;
+}
+
+void KBookmarkIndex::insertIcon(const QString &key, const QString &icon)
+{
+    QMutexLocker locker(&m_mutex);
+    m_icons.insert(key, icon);
+}
+
+int KBookmarkIndex::iconCacheHits() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_iconCacheHits;
+}
+
+int KBookmarkIndex::iconCacheMisses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_iconCacheMisses;
+}
+
+void KBookmarkIndex::setLazyTree(const KBookmarkTree &tree, const QDomElement &root)
+{
+    QMutexLocker locker(&m_mutex);
+    m_tree = tree;
+    ShallowFolder shallow;
+    shallow.folder = root;
+    shallow.node = tree.documentElement();
+    m_shallowFolders.insert(kbookmarkNodeKey(root), shallow);
+}
+
+void KBookmarkIndex::loadGroup(const QDomElement &group)
+{
+    if (m_shallowFolders.isEmpty()) {
+        return;
+    }
+    QHash<quintptr, ShallowFolder>::iterator it = m_shallowFolders.find(kbookmarkNodeKey(group));
+    if (it == m_shallowFolders.end()) {
+        return;
+    }
+    const ShallowFolder shallow = it.value();
+    m_shallowFolders.erase(it);
+
+    QVector<QPair<QDomElement, int> > subFolders;
+    QDomElement folder = shallow.folder;
+    m_tree.loadShallowChildren(m_document, folder, shallow.node, &subFolders);
+    for (int i = 0; i < subFolders.count(); ++i) {
+        ShallowFolder entry;
+        entry.folder = subFolders.at(i).first;
+        entry.node = subFolders.at(i).second;
+        m_shallowFolders.insert(kbookmarkNodeKey(entry.folder), entry);
+    }
+    if (m_shallowFolders.isEmpty()) {
+        m_tree.clear();
+    }
+}
+
+void KBookmarkIndex::loadSubtree(const QDomElement &element)
+{
+    loadGroup(element);
+    for (QDomElement e = element.firstChildElement(QStringLiteral("folder")); !e.isNull() && !m_shallowFolders.isEmpty();
+         e = e.nextSiblingElement(QStringLiteral("folder"))) {
+        loadSubtree(e);
+    }
+}
+
+// Deleted folders don't need to be loaded anymore
+void KBookmarkIndex::dropShallowFolders(const QDomElement &element)
+{
+    if (m_shallowFolders.isEmpty() || element.tagName() != QLatin1String("folder")) {
+        return;
+    }
+    if (m_shallowFolders.remove(kbookmarkNodeKey(element)) > 0) {
+        if (m_shallowFolders.isEmpty()) {
+            m_tree.clear();
+        }
+        return; // nothing loaded below it
+    }
+    for (QDomElement e = element.firstChildElement(QStringLiteral("folder")); !e.isNull(); e = e.nextSiblingElement(QStringLiteral("folder"))) {
+        dropShallowFolders(e);
+    }
+}
+
+void KBookmarkIndex::loadAllGroups()
+{
+    while (!m_shallowFolders.isEmpty()) {
+        loadGroup(m_shallowFolders.begin().value().folder);
+    }
+}
+
+void KBookmarkIndex::ensureLoaded(const QDomElement &group)
+{
+    QMutexLocker locker(&m_mutex);
+    loadGroup(group);
+}
+
+void KBookmarkIndex::ensureSubtreeLoaded(const QDomElement &element)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_shallowFolders.isEmpty()) {
+        const QString tag = element.tagName();
+        if (tag == QLatin1String("folder") || tag == QLatin1String("xbel")) {
+            loadSubtree(element);
+        }
+    }
+}
+
+void KBookmarkIndex::loadAll()
+{
+    QMutexLocker locker(&m_mutex);
+    loadAllGroups();
+}
+
+bool KBookmarkIndex::hasShallowFolders() const
+{
+    QMutexLocker locker(&m_mutex);
+    return !m_shallowFolders.isEmpty();
+}
+
+bool KBookmarkIndex::mayContainToolbar(const QDomElement &folder)
+{
+    QMutexLocker locker(&m_mutex);
+    const QHash<quintptr, ShallowFolder>::const_iterator it = m_shallowFolders.constFind(kbookmarkNodeKey(folder));
+    return it == m_shallowFolders.constEnd() || m_tree.containsToolbar(it.value().node);
+}
+
+void KBookmarkIndex::setAccessStats(KBookmarkAccessStats *stats)
+{
+    m_accessStats = stats;
+}
+
+KBookmarkAccessStats *KBookmarkIndex::accessStats() const
+{
+    return m_accessStats;
+}
+
+KBookmarkOpLog &KBookmarkIndex::opLog()
+{
+    return m_opLog;
+}
+
+void KBookmarkIndex::setDirectAccess()
+{
+    QMutexLocker locker(&m_mutex);
+    m_directAccess = true;
+}
+
+bool KBookmarkIndex::takeDirectAccess()
+{
+    QMutexLocker locker(&m_mutex);
+    const bool directAccess = m_directAccess;
+    m_directAccess = false;
+    return directAccess;
+}
+
+void KBookmarkIndex::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_opLog.clear();
+    m_directAccess = false;
+    m_groups.clear();
+    m_urls.clear();
+    m_urlsBuilt = false;
+    m_ids.clear();
+    m_idsBuilt = false;
+    m_icons.clear();
+    m_fields.clear();
+    m_snapshotNodes.clear();
+    m_shallowFolders.clear();
+    m_tree.clear();
+    ++m_structureGeneration;
+}
@@ -0,0 +1,328 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKINDEX_P_H
+#define KBOOKMARKINDEX_P_H
+
+#include "kbookmarkaccessstats_p.h"
+#include "kbookmarkoplog_p.h"
+#include "kbookmarksnapshot_p.h"
+#include "kbookmarktree_p.h"
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QUrl>
+#include <QVector>
+
+/**
+ * @return a key identifying the node behind @p node; all QDomNode
+ * handles to the same node share it. 0 for a null node.
+ */
+quintptr kbookmarkNodeKey(const QDomNode &node);
+
+class KBookmark;
+/**
+ * Same as KBookmark::internalElement(), for the library itself: doesn't load
+ * anything lazily, and doesn't count as a direct DOM change.
+ */
+QDomElement kbookmarkElement(const KBookmark &bookmark);
+/**
+ * Sets an attribute which has no setter in the KBookmark API, e.g. the
+ * "netscapeinfo" of imported bookmarks, reporting it as the setters do
+ */
+void kbookmarkSetAttribute(const KBookmark &bookmark, const QString &name, const QString &value);
+/**
+ * bookmark.url().toDisplayString(QUrl::PreferLocalFile), cached by the
+ * index when there is one
+ */
+QString kbookmarkDisplayUrl(const KBookmark &bookmark);
+
+/**
+ * Caches derived from the document of a KBookmarkManager.
+ *
+ * KBookmark only wraps a QDomElement and can't know its manager, so every
+ * manager registers its document here, and KBookmark finds the index via
+ * the owner document of its element (forNode()). Bookmarks living in other
+ * documents (standalone bookmarks, drag and drop) simply get no index and
+ * use the uncached code paths.
+ *
+ * The KBookmarkGroup API reports every structural change, so that the
+ * caches stay valid without watching the DOM.
+ * @internal
+ */
+class KBookmarkIndex
+{
+public:
+    KBookmarkIndex();
+    ~KBookmarkIndex();
+
+    /**
+     * Makes @p doc the indexed document, dropping everything cached about the previous one.
+     */
+    void setDocument(const QDomDocument &doc);
+
+    /**
+     * @return the index of the document owning @p node, or nullptr
+     */
+    static KBookmarkIndex *forNode(const QDomNode &node);
+
+    /**
+     * Same as KBookmarkGroup::indexOf(), but only walks the children of
+     * @p group once until it changes.
+     */
+    int position(const QDomElement &group, const QDomElement &child);
+    /**
+     * @return the folder, bookmark or separator at @p position in @p group,
+     * a null element if there is none
+     */
+    QDomElement child(const QDomElement &group, int position);
+    /**
+     * @return the number of folders, bookmarks and separators in @p group
+     */
+    int childCount(const QDomElement &group);
+
+    /**
+     * Increased by every structural change, so that caches built on
+     * top of this one can tell whether they are still valid.
+     */
+    quint64 structureGeneration() const;
+
+    /**
+     * Increased by every change to the document, see KBookmarkManager::generation().
+     * Unlike structureGeneration(), not reset when the document is replaced:
+     * materializing a lazily loaded document isn't a change.
+     */
+    quint64 generation() const;
+    void documentChanged();
+
+    /**
+     * Children of @p group were added, removed or moved.
+     */
+    void invalidateGroup(const QDomElement &group);
+
+    /**
+     * @return the \<bookmark\> elements pointing to @p url
+     *
+     * The URL index is built on first use and then kept up to date by
+     * bookmarksAdded(), bookmarksRemoved() and urlChanged().
+     */
+    QList<QDomElement> bookmarksForUrl(const QUrl &url);
+    /**
+     * @p subtree, a bookmark or a folder, was inserted into the document
+     */
+    void bookmarksAdded(const QDomElement &subtree);
+    /**
+     * @p subtree, a bookmark or a folder, was removed from the document
+     */
+    void bookmarksRemoved(const QDomElement &subtree);
+    void urlChanged(const QDomElement &bookmark, const QString &oldHref);
+
+    /**
+     * @return the folder or bookmark with the XBEL id @p id, a null element
+     * if there is none
+     *
+     * Built on first use like the URL index, and kept up to date by
+     * bookmarksAdded(), bookmarksRemoved() and idAssigned(). Copies added
+     * to the document get a new id, the element indexed first keeps it.
+     */
+    QDomElement elementForId(const QString &id);
+    /**
+     * @p element got its first id
+     */
+    void idAssigned(const QDomElement &element);
+    /**
+     * @return a new XBEL id
+     */
+    static QString createId();
+
+    /**
+     * KBookmark::url(), KBookmark::text() and the URL as shown to the user,
+     * computed on first use and kept until fieldsChanged() is called for
+     * @p element.
+     */
+    QUrl url(const QDomElement &element);
+    QString text(const QDomElement &element);
+    QString displayUrl(const QDomElement &element);
+    /**
+     * The metadata items of bookmarks (see KBookmark::metaDataItem()) are
+     * looked up once, and then found by the atom interned for their owner
+     * and key. A null @p item means that there is none.
+     * @return false if @p atom wasn't looked up for @p element yet
+     */
+    bool cachedMetaDataItem(const QDomElement &element, int atom, QDomElement *item);
+    void insertMetaDataItem(const QDomElement &element, int atom, const QDomElement &item);
+    int metaDataAtom(const QString &owner, const QString &key);
+
+    /**
+     * The title or URL of @p element changed, or its metadata outside of
+     * the KBookmark API
+     */
+    void fieldsChanged(const QDomElement &element);
+    /**
+     * Anything could have changed through the DOM: drops the positions and
+     * the fields, and counts as a structural change. The URL and id indexes
+     * are only refreshed by KBookmarkManager::emitChanged().
+     */
+    void invalidateAll();
+
+    /**
+     * The nodes of the snapshots taken last (see KBookmarkSnapshot), until
+     * the bookmark or folder, or anything below it, changes.
+     * @return false if there is none for @p element
+     */
+    bool cachedSnapshotNode(const QDomElement &element, KBookmarkSnapshotNode::Ptr *node);
+    void insertSnapshotNode(const QDomElement &element, const KBookmarkSnapshotNode::Ptr &node);
+
+    /**
+     * Icons of bookmarks without an explicit icon come from the mime
+     * database, see KBookmark::icon(). @p key identifies the lookup.
+     * @return whether the icon for @p key is known, in @p icon
+     */
+    bool cachedIcon(const QString &key, QString *icon);
+    void insertIcon(const QString &key, const QString &icon);
+    int iconCacheHits() const;
+    int iconCacheMisses() const;
+
+    /**
+     * Lazy loading: @p root was created with KBookmarkTree::toShallowElement()
+     * from @p tree, folders get their children from @p tree when they are needed.
+     */
+    void setLazyTree(const KBookmarkTree &tree, const QDomElement &root);
+    /**
+     * Makes sure the folders, bookmarks and separators in @p group are loaded
+     */
+    void ensureLoaded(const QDomElement &group);
+    /**
+     * Same as ensureLoaded(), for all folders below @p element too
+     */
+    void ensureSubtreeLoaded(const QDomElement &element);
+    void loadAll();
+    bool hasShallowFolders() const;
+    /**
+     * Same as KBookmarkGroup::findToolbar() not returning a null element,
+     * but without loading @p folder.
+     */
+    bool mayContainToolbar(const QDomElement &folder);
+
+    /**
+     * The access metadata of the manager's bookmarks, if it has a file
+     */
+    void setAccessStats(KBookmarkAccessStats *stats);
+    KBookmarkAccessStats *accessStats() const;
+
+    /**
+     * The changes to broadcast to the other processes, see KBookmarkOpLog.
+     * Only used from the GUI thread.
+     */
+    KBookmarkOpLog &opLog();
+
+    /**
+     * The DOM was handed out through KBookmark::internalElement() or
+     * KBookmarkManager::internalDocument(), and may have been changed behind
+     * our back. Nothing is invalidated until the caller reports its changes
+     * with KBookmarkManager::emitChanged(), see takeDirectAccess().
+     */
+    void setDirectAccess();
+    /**
+     * @return whether setDirectAccess() was called since the last call
+     */
+    bool takeDirectAccess();
+
+    void clear();
+
+private:
+    struct GroupEntry {
+        QDomElement group; // keeps the node, and thus its key, alive
+        QHash<quintptr, int> positions;
+        QVector<QDomElement> children;
+    };
+    const GroupEntry &groupEntry(const QDomElement &group);
+    void insertUrls(const QDomElement &elem);
+    void removeUrls(const QDomElement &elem);
+    bool isIndexedBookmark(const QDomElement &elem, const QString &urlKey) const;
+    bool isInDocument(const QDomElement &elem) const;
+    void insertIds(const QDomElement &elem, QVector<QDomElement> *renamed);
+    void removeIds(const QDomElement &elem);
+    void recordRenamed(const QVector<QDomElement> &renamed);
+    struct FieldEntry;
+    FieldEntry &fieldEntry(const QDomElement &element);
+    void removeFields(const QDomElement &elem);
+    void dropSnapshotPath(const QDomNode &node);
+    void removeSnapshotNodes(const QDomElement &elem);
+    void loadGroup(const QDomElement &group);
+    void loadSubtree(const QDomElement &element);
+    void dropShallowFolders(const QDomElement &element);
+    void loadAllGroups();
+
+    mutable QMutex m_mutex;
+    QDomDocument m_document;
+    quintptr m_documentKey;
+    quint64 m_structureGeneration;
+    quint64 m_generation;
+    QHash<quintptr, GroupEntry> m_groups;
+    // normalized href -> bookmarks
+    QHash<QString, QVector<QDomElement> > m_urls;
+    bool m_urlsBuilt;
+    QHash<QString, QDomElement> m_ids;
+    bool m_idsBuilt;
+
+    struct FieldEntry {
+        enum Field {
+            Url = 1,
+            Text = 2,
+            DisplayUrl = 4
+        };
+        QDomElement element; // keeps the node, and thus its key, alive
+        int fields = 0;      // the ones computed already
+        QUrl url;
+        QString text;
+        QString displayUrl;
+        QHash<int, QDomElement> metaDataItems; // by atom
+    };
+    QHash<quintptr, FieldEntry> m_fields;
+    KBookmarkStringPool m_metaDataAtoms;
+
+    struct SnapshotEntry {
+        QDomElement element; // keeps the node, and thus its key, alive
+        KBookmarkSnapshotNode::Ptr node;
+    };
+    QHash<quintptr, SnapshotEntry> m_snapshotNodes;
+
+    // mime type or URL key -> icon name
+    QHash<QString, QString> m_icons;
+    int m_iconCacheHits;
+    int m_iconCacheMisses;
+
+    struct ShallowFolder {
+        QDomElement folder;
+        int node; // in m_tree
+    };
+    // folders whose children weren't loaded yet
+    QHash<quintptr, ShallowFolder> m_shallowFolders;
+    KBookmarkTree m_tree;
+
+    KBookmarkOpLog m_opLog;
+    bool m_directAccess;
+    KBookmarkAccessStats *m_accessStats;
+};
+
+#endif
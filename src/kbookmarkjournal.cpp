@@ -0,0 +1,246 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkjournal_p.h"
+#include "kbookmarkindex_p.h"
+#include "kbookmarkoplog_p.h"
+#include "kbookmarks_debug.h"
+
+#include <QDataStream>
+#include <QDomDocument>
+#include <QFile>
+#include <QSaveFile>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+enum {
+    JournalMagic = 0x4b424d4a, // "KBMJ"
+    JournalVersion = 2,
+    HashSize = 20,
+    HeaderSize = 8 + HashSize,
+    RecordHeaderSize = 8 // payload size and checksum
+};
+
+struct Record {
+    qulonglong baseRevision;
+    QByteArray operations;
+};
+}
+
+// Same attribute as the one written by KBookmarkManager
+static QString revisionAttribute()
+{
+    return QStringLiteral("revision");
+}
+
+static QByteArray header(const QByteArray &sourceHash)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << quint32(JournalMagic) << quint32(JournalVersion);
+    stream.writeRawData(sourceHash.constData(), HashSize);
+    return data;
+}
+
+static QVector<quint32> crc32Table()
+{
+    QVector<quint32> table(256);
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+// The CRC-32 (as in zlib) of a record: qChecksum() only has 16 bits
+static quint32 crc32(const char *data, int size)
+{
+    static const QVector<quint32> table = crc32Table();
+    quint32 crc = 0xffffffff;
+    for (int i = 0; i < size; ++i) {
+        crc = table.at((crc ^ uchar(data[i])) & 0xff) ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+// Whether the journal in @p file continues the contents with the SHA-1 @p sourceHash
+static bool continues(QFile &file, const QByteArray &sourceHash)
+{
+    return sourceHash.size() == HashSize && file.read(HeaderSize) == header(sourceHash);
+}
+
+QString KBookmarkJournal::fileName(const QString &bookmarksFile)
+{
+    return bookmarksFile + QLatin1String(".journal");
+}
+
+bool KBookmarkJournal::reset(const QString &bookmarksFile, const QByteArray &sourceHash)
+{
+    if (sourceHash.size() != HashSize) {
+        return false;
+    }
+    QSaveFile file(fileName(bookmarksFile));
+    if (!file.open(QIODevice::WriteOnly) || file.write(header(sourceHash)) != HeaderSize || !file.commit()) {
+        qCWarning(KBOOKMARKS_LOG) << "Could not write the bookmark journal" << file.fileName() << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool KBookmarkJournal::append(const QString &bookmarksFile, const QByteArray &sourceHash,
+                              qulonglong baseRevision, const QByteArray &operations, qint64 *size)
+{
+    QByteArray payload;
+    {
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+        stream << quint64(baseRevision);
+        stream.writeRawData(operations.constData(), operations.size());
+    }
+    QByteArray record;
+    {
+        QDataStream stream(&record, QIODevice::WriteOnly);
+        stream << quint32(payload.size()) << crc32(payload.constData(), payload.size());
+    }
+    record += payload;
+
+    // The header is checked and the record appended through the same descriptor, so that
+    // it goes to the journal which was checked
+    const QIODevice::OpenMode mode = QIODevice::ReadWrite | QIODevice::Append | QIODevice::Unbuffered;
+    QFile file(fileName(bookmarksFile));
+#ifdef Q_OS_UNIX
+    // Without O_CREAT: a journal removed by a full save in the meantime isn't created again without a header
+    const int fd = ::open(QFile::encodeName(file.fileName()).constData(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    if (!file.open(fd, mode, QFileDevice::AutoCloseHandle)) {
+        ::close(fd);
+        qCWarning(KBOOKMARKS_LOG) << "Can't write" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+#else
+    if (!file.exists() || !file.open(mode)) {
+        return false;
+    }
+#endif
+    if (!file.seek(0) || !continues(file, sourceHash)) {
+        return false; // another process rewrote the file since
+    }
+    // A single write, so that records appended by several processes don't get mixed
+    if (file.write(record) != record.size()) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't write" << file.fileName() << ":" << file.errorString();
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    if (::fsync(file.handle()) != 0) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't sync" << file.fileName();
+        return false;
+    }
+    // Replaced by another process in the meantime: the record went to the old journal
+    struct stat written;
+    struct stat current;
+    if (::fstat(file.handle(), &written) != 0 || ::stat(QFile::encodeName(file.fileName()).constData(), &current) != 0
+            || written.st_dev != current.st_dev || written.st_ino != current.st_ino) {
+        return false;
+    }
+#endif
+    *size = file.size();
+    return true;
+}
+
+// Applies the first @p count records to a copy of @p tree, and returns how
+// many of them applied; @p result is only usable if all of them did
+static int applyRecords(const KBookmarkTree &tree, const QVector<Record> &records, int count, KBookmarkTree *result)
+{
+    QDomDocument doc(QStringLiteral("xbel"));
+    QDomElement root = tree.toElement(doc, tree.documentElement());
+    doc.appendChild(root);
+    // KBookmarkOpLog::apply() resolves addresses through an index
+    KBookmarkIndex index;
+    index.setDocument(doc);
+    QStringList changedGroups;
+    int applied = 0;
+    for (; applied < count; ++applied) {
+        const Record &record = records.at(applied);
+        if (root.attribute(revisionAttribute()).toULongLong() != record.baseRevision
+                || !KBookmarkOpLog::apply(record.operations, doc, &index, &changedGroups)) {
+            break;
+        }
+        root.setAttribute(revisionAttribute(), QString::number(record.baseRevision + 1));
+    }
+    *result = KBookmarkTree::fromElement(root);
+    return applied;
+}
+
+int KBookmarkJournal::replay(const QString &bookmarksFile, const QByteArray &sourceHash, KBookmarkTree *tree)
+{
+    QFile file(fileName(bookmarksFile));
+    if (tree->isEmpty() || !file.open(QIODevice::ReadOnly) || !continues(file, sourceHash)) {
+        return 0;
+    }
+    const QByteArray data = file.readAll();
+    file.close();
+
+    QVector<Record> records;
+    QDataStream stream(data);
+    while (!stream.atEnd()) {
+        quint32 size;
+        quint32 checksum;
+        stream >> size >> checksum;
+        const int offset = int(stream.device()->pos());
+        if (stream.status() != QDataStream::Ok || size < 8 || size > quint32(data.size() - offset)
+                || checksum != crc32(data.constData() + offset, size)) {
+            qCWarning(KBOOKMARKS_LOG) << "Ignoring the incomplete end of" << file.fileName();
+            break;
+        }
+        Record record;
+        quint64 baseRevision;
+        stream >> baseRevision;
+        record.baseRevision = baseRevision;
+        record.operations = data.mid(offset + 8, size - 8);
+        stream.skipRawData(size - 8);
+        records.append(record);
+    }
+    if (records.isEmpty()) {
+        return 0;
+    }
+
+    KBookmarkTree result;
+    int applied = applyRecords(*tree, records, records.count(), &result);
+    if (applied < records.count()) {
+        qCWarning(KBOOKMARKS_LOG) << "Record" << applied << "of" << file.fileName() << "doesn't apply, ignoring the rest";
+        // The document is partially modified by the failed record, start over without it
+        if (applied == 0 || applyRecords(*tree, records, applied, &result) != applied) {
+            return 0;
+        }
+    }
+    *tree = result;
+    return applied;
+}
@@ -0,0 +1,69 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKJOURNAL_P_H
+#define KBOOKMARKJOURNAL_P_H
+
+#include "kbookmarktree_p.h"
+
+#include <QByteArray>
+
+/**
+ * The changes saved since the bookmark file was last written completely,
+ * stored next to it as "<file>.journal", see KBookmarkManager::setJournalEnabled().
+ *
+ * The journal starts with the SHA-1 of the file it continues, and is
+ * ignored as soon as the file has other contents. Each record holds the
+ * operations of a KBookmarkOpLog and the revision they apply to, with a
+ * CRC-32, and is appended with a single write flushed to the disk. A record
+ * cut short by a crash ends the journal.
+ * @internal
+ */
+class KBookmarkJournal
+{
+public:
+    static QString fileName(const QString &bookmarksFile);
+
+    /**
+     * Starts an empty journal for @p bookmarksFile
+     * @param sourceHash the SHA-1 of the current contents of @p bookmarksFile
+     */
+    static bool reset(const QString &bookmarksFile, const QByteArray &sourceHash);
+
+    /**
+     * Appends the operations taking the document from @p baseRevision to the next revision
+     * @param sourceHash the SHA-1 of the contents of @p bookmarksFile known to the caller
+     * @param size gets the size of the journal afterwards
+     * @return false if there is no journal continuing these contents, or it
+     * can't be written; the changes then have to be saved to the file itself
+     */
+    static bool append(const QString &bookmarksFile, const QByteArray &sourceHash,
+                       qulonglong baseRevision, const QByteArray &operations, qint64 *size);
+
+    /**
+     * Replays the journal of @p bookmarksFile on @p tree, read from the file.
+     * Stops at the first record which doesn't apply.
+     * @param sourceHash the SHA-1 of the contents @p tree was read from
+     * @return the number of records replayed
+     */
+    static int replay(const QString &bookmarksFile, const QByteArray &sourceHash, KBookmarkTree *tree);
+};
+
+#endif
@@ -22,34 +22,51 @@
 #include "kbookmarkmanager.h"
 
 #include "kbookmarks_debug.h"
+#include <QCryptographicHash>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QProcess>
-#include <QRegularExpression>
-#include <QTextStream>
-#include <QTextCodec>
 #include <QDBusConnection>
 #include <QMessageBox>
 #include <QApplication>
 #include <QReadWriteLock>
 #include <QThread>
+#include <QTimer>
 
 #include <QDBusMessage>
-#include <kbackup.h>
 #include <kconfig.h>
 #include <kconfiggroup.h>
 #include <KDirWatch>
-#include <qsavefile.h>
 #include <qstandardpaths.h>
 
 #include "kbookmarkmenu.h"
 #include "kbookmarkmenu_p.h"
 #include "kbookmarkimporter.h"
 #include "kbookmarkdialog.h"
+#include "kbookmarksnapshot.h"
 #include "kbookmarkmanageradaptor_p.h"
+#include "kbookmarktree_p.h"
+#include "kbookmarkaddress_p.h"
+#include "kbookmarkbackup_p.h"
+#include "kbookmarkbinarycache_p.h"
+#include "kbookmarkaccessstats_p.h"
+#include "kbookmarkindex_p.h"
+#include "kbookmarkjournal_p.h"
+#include "kbookmarkmigration_p.h"
+#include "kbookmarksaver_p.h"
+#include "kbookmarkxbelreader_p.h"
 
 #define BOOKMARK_CHANGE_NOTIFY_INTERFACE "org.kde.KIO.KBookmarkManager"
+// Attribute of the root element, increased with every change broadcast along with a delta
+#define REVISION_ATTRIBUTE "revision"
+
+// A document generation never written to the file
+static const quint64 s_notSaved = ~quint64(0);
+
+// Journal mode: compaction once nothing was saved for that long, in ms
+static const int s_journalIdleDelay = 30000;
 
 class KBookmarkManagerList : public QList<KBookmarkManager *>
 {
@@ -82,54 +99,6 @@ KBookmarkManagerList::KBookmarkManagerList()
     qAddPostRoutine(deleteManagers);
 }
 
-class KBookmarkMap : private KBookmarkGroupTraverser
-{
-public:
-    KBookmarkMap() : m_mapNeedsUpdate(true) {}
-    void setNeedsUpdate()
-    {
-        m_mapNeedsUpdate = true;
-    }
-    void update(KBookmarkManager *);
-    QList<KBookmark> find(const QString &url) const
-    {
-        return m_bk_map.value(url);
-    }
-private:
-    void visit(const KBookmark &) override;
-    void visitEnter(const KBookmarkGroup &) override
-    {
-        ;
-    }
-    void visitLeave(const KBookmarkGroup &) override
-    {
-        ;
-    }
-private:
-    typedef QList<KBookmark> KBookmarkList;
-    QMap<QString, KBookmarkList> m_bk_map;
-    bool m_mapNeedsUpdate;
-};
-
-void KBookmarkMap::update(KBookmarkManager *manager)
-{
-    if (m_mapNeedsUpdate) {
-        m_mapNeedsUpdate = false;
-
-        m_bk_map.clear();
-        KBookmarkGroup root = manager->root();
-        traverse(root);
-    }
-}
-
-void KBookmarkMap::visit(const KBookmark &bk)
-{
-    if (!bk.isSeparator()) {
-        // add bookmark to url map
-        m_bk_map[bk.internalElement().attribute(QStringLiteral("href"))].append(bk);
-    }
-}
-
 // #########################
 // KBookmarkManagerPrivate
 class KBookmarkManagerPrivate
@@ -145,15 +114,65 @@ public:
         , m_browserEditor(false)
         , m_typeExternal(false)
         , m_dirWatch(nullptr)
-    {}
+        , m_addressCacheGeneration(0)
+        , m_saveDelay(0)
+        , m_saveTimer(nullptr)
+        , m_saver(nullptr)
+        , m_hasPendingSave(false)
+        , m_saveInFlight(false)
+        , m_handledSaveResults(0)
+        , m_writingBaseRevision(0)
+        , m_writingHasDelta(false)
+        , m_lazyLoading(false)
+        , m_accessStats(nullptr)
+        , m_transactionDepth(0)
+        , m_transactionChanged(false)
+        , m_savedGeneration(s_notSaved)
+        , m_writingGeneration(s_notSaved)
+        , m_transactionGeneration(0)
+        , m_dbusRegistered(false)
+        , m_journalEnabled(false)
+        , m_journalThreshold(512 * 1024)
+        , m_journalTimer(nullptr)
+    {
+        m_index.setDocument(m_doc);
+    }
 
     ~KBookmarkManagerPrivate()
     {
         delete m_dirWatch;
+        m_index.setAccessStats(nullptr);
+        delete m_accessStats;
+    }
+
+    void createAccessStats()
+    {
+        m_accessStats = new KBookmarkAccessStats(m_bookmarksFile);
+        m_index.setAccessStats(m_accessStats);
+    }
+
+    void setDocument(const QDomDocument &doc) const
+    {
+        m_doc = doc;
+        m_index.setDocument(doc);
+    }
+    void materializeDocument() const;
+    bool readFile(KBookmarkTree *tree);
+    bool checkDbusName(KBookmarkTree *tree);
+    void mergeTree(const KBookmarkTree &tree, QStringList *changedGroups);
+    void mergeGroup(QDomElement &group, const KBookmarkTree &tree, int node, const QString &address, QStringList *changedGroups);
+    void rebuildGroup(QDomElement &group, const KBookmarkTree &tree, int node, const QVector<QDomElement> &oldChildren);
+    bool prepareDelta(qulonglong *baseRevision, QByteArray *operations);
+    // Whether the file has the document as it is now
+    bool isSaved() const
+    {
+        return m_savedGeneration == m_index.generation() && QFile::exists(m_bookmarksFile);
     }
 
     mutable QDomDocument m_doc;
     mutable QDomDocument m_toolbarDoc;
+    // The parsed file, until the DOM is materialized from it
+    mutable KBookmarkTree m_tree;
     QString m_bookmarksFile;
     QString m_dbusObjectName;
     mutable bool m_docIsLoaded;
@@ -167,9 +186,77 @@ public:
     bool m_typeExternal;
     KDirWatch *m_dirWatch;   // for external bookmark files
 
-    KBookmarkMap m_map;
+    mutable KBookmarkIndex m_index;
+    // findByAddress() results, valid as long as the index generation doesn't change
+    QHash<QString, QDomElement> m_addressCache;
+    quint64 m_addressCacheGeneration;
+
+    // write-behind saving, see setSaveDelay()
+    int m_saveDelay;
+    QTimer *m_saveTimer;
+    KBookmarkSaver *m_saver;
+    bool m_hasPendingSave;   // changes waiting for the timer
+    QString m_pendingAddress;
+    bool m_saveInFlight;     // changes being written by m_saver
+    QString m_writingAddress;
+    QString m_writingGroupId;
+    int m_handledSaveResults; // finished() signals still queued for writes flush() waited for
+    qulonglong m_writingBaseRevision;
+    QByteArray m_writingOperations;
+    bool m_writingHasDelta;
+
+    // The groups changed by the delta last received, whose bookmarksChanged() comes next
+    QString m_appliedDeltaSender;
+    QStringList m_appliedDeltaGroups;
+
+    bool m_lazyLoading;
+    // visits, kept out of the bookmark file
+    KBookmarkAccessStats *m_accessStats;
+
+    // see beginTransaction()
+    int m_transactionDepth;
+    QDomDocument m_transactionBackup;
+    bool m_transactionChanged;  // emitChanged() was called
+    // The group containing all the changes, kept as an element because later
+    // changes can move it to another address
+    QDomElement m_transactionGroup;
+
+    // The generation of the document read from or written to the file last
+    quint64 m_savedGeneration;
+    quint64 m_writingGeneration; // by m_saver
+    quint64 m_transactionGeneration; // in beginTransaction()
+
+    bool m_dbusRegistered; // the op log is needed for the deltas
+    // see setJournalEnabled()
+    bool m_journalEnabled;
+    qint64 m_journalThreshold;
+    QTimer *m_journalTimer; // compaction when idle
+    QByteArray m_fileHash;  // SHA-1 of the file read or written last, which the journal continues
+
+    KBookmarkBackup::Policy m_backupPolicy;
 };
 
+#define PI_DATA "version=\"1.0\" encoding=\"UTF-8\""
+
+void KBookmarkManagerPrivate::materializeDocument() const
+{
+    if (m_tree.isEmpty()) {
+        return;
+    }
+    QDomDocument doc(QStringLiteral("xbel"));
+    const int root = m_tree.documentElement();
+    QDomElement docElem = m_lazyLoading ? m_tree.toShallowElement(doc, root) : m_tree.toElement(doc, root);
+    doc.appendChild(docElem);
+    doc.insertBefore(doc.createProcessingInstruction(QStringLiteral("xml"), PI_DATA), docElem);
+    setDocument(doc);
+    if (m_lazyLoading) {
+        // The toplevel items are needed right away anyway
+        m_index.setLazyTree(m_tree, docElem);
+        m_index.ensureLoaded(docElem);
+    }
+    m_tree.clear();
+}
+
 // ################
 // KBookmarkManager
 
@@ -236,8 +323,6 @@ KBookmarkManager *KBookmarkManager::createTempManager()
     return mgr;
 }
 
-#define PI_DATA "version=\"1.0\" encoding=\"UTF-8\""
-
 static QDomElement createXbelTopLevelElement(QDomDocument &doc)
 {
     QDomElement topLevel = doc.createElement(QStringLiteral("xbel"));
@@ -263,6 +348,7 @@ KBookmarkManager::KBookmarkManager(const QString &bookmarksFile, const QString &
 
     Q_ASSERT(!bookmarksFile.isEmpty());
     d->m_bookmarksFile = bookmarksFile;
+    d->createAccessStats();
 
     if (!QFile::exists(d->m_bookmarksFile)) {
         QDomElement topLevel = createXbelTopLevelElement(d->m_doc);
@@ -280,6 +366,7 @@ KBookmarkManager::KBookmarkManager(const QString &bookmarksFile)
 
     Q_ASSERT(!bookmarksFile.isEmpty());
     d->m_bookmarksFile = bookmarksFile;
+    d->createAccessStats();
 
     if (!QFile::exists(d->m_bookmarksFile)) {
         createXbelTopLevelElement(d->m_doc);
@@ -291,6 +378,7 @@ KBookmarkManager::KBookmarkManager(const QString &bookmarksFile)
     // start KDirWatch
     d->m_dirWatch = new KDirWatch;
     d->m_dirWatch->addFile(d->m_bookmarksFile);
+    d->m_dirWatch->addFile(KBookmarkJournal::fileName(d->m_bookmarksFile));
     QObject::connect(d->m_dirWatch, &KDirWatch::dirty,
             this, &KBookmarkManager::slotFileChanged);
     QObject::connect(d->m_dirWatch, &KDirWatch::created,
@@ -322,6 +410,10 @@ void KBookmarkManager::init(const QString &dbusPath)
                                               QStringLiteral("bookmarksChanged"), this, SLOT(notifyChanged(QString,QDBusMessage)));
         QDBusConnection::sessionBus().connect(QString(), dbusPath, BOOKMARK_CHANGE_NOTIFY_INTERFACE,
                                               QStringLiteral("bookmarkConfigChanged"), this, SLOT(notifyConfigChanged()));
+        QDBusConnection::sessionBus().connect(QString(), dbusPath, BOOKMARK_CHANGE_NOTIFY_INTERFACE,
+                                              QStringLiteral("bookmarksDelta"), this, SLOT(notifyDelta(qulonglong,qulonglong,QByteArray,QDBusMessage)));
+        d->m_index.opLog().setEnabled(true);
+        d->m_dbusRegistered = true;
     }
 }
 
@@ -344,13 +436,16 @@ void KBookmarkManager::startKEditBookmarks(const QStringList &args)
 
 void KBookmarkManager::slotFileChanged(const QString &path)
 {
-    if (path == d->m_bookmarksFile) {
+    if (path == d->m_bookmarksFile || path == KBookmarkJournal::fileName(d->m_bookmarksFile)) {
+        if (d->m_hasPendingSave || d->m_saveInFlight) {
+            return; // our own write, or reparsing would lose the pending changes
+        }
         // qCDebug(KBOOKMARKS_LOG) << "file changed (KDirWatch) " << path ;
-        // Reparse
-        parse();
-        // Tell our GUI
-        // (emit where group is "" to directly mark the root menu as dirty)
-        emit changed(QLatin1String(""), QString());
+        // Reparse, and tell our GUI about the groups which changed
+        const QStringList changedGroups = reparse();
+        for (const QString &groupAddress : changedGroups) {
+            emit changed(groupAddress, QString());
+        }
     }
 }
 
@@ -360,6 +455,11 @@ KBookmarkManager::~KBookmarkManager()
         s_pSelf()->removeAll(this);
     }
 
+    if (d->m_saver) {
+        flush();
+        delete d->m_saver;
+    }
+
     delete d;
 }
 
@@ -380,63 +480,290 @@ void KBookmarkManager::setUpdate(bool update)
 }
 
 QDomDocument KBookmarkManager::internalDocument() const
+{
+    const QDomDocument doc = shallowDocument();
+    d->m_index.loadAll();
+    // The caller can change anything, behind the back of the KBookmark API
+    d->m_index.setDirectAccess();
+    return doc;
+}
+
+QDomDocument KBookmarkManager::shallowDocument() const
 {
     if (!d->m_docIsLoaded) {
         parse();
         d->m_toolbarDoc.clear();
     }
+    d->materializeDocument();
     return d->m_doc;
 }
 
-void KBookmarkManager::parse() const
+void KBookmarkManager::setLazyLoadingEnabled(bool enable)
 {
-    d->m_docIsLoaded = true;
-    // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::parse " << d->m_bookmarksFile;
-    QFile file(d->m_bookmarksFile);
+    d->m_lazyLoading = enable;
+    if (!enable) {
+        d->m_index.loadAll();
+    }
+}
+
+bool KBookmarkManager::isLazyLoadingEnabled() const
+{
+    return d->m_lazyLoading;
+}
+
+// Reads the bookmark file, from its binary cache if possible
+bool KBookmarkManagerPrivate::readFile(KBookmarkTree *tree)
+{
+    QFile file(m_bookmarksFile);
     if (!file.open(QIODevice::ReadOnly)) {
-        qCWarning(KBOOKMARKS_LOG) << "Can't open " << d->m_bookmarksFile;
-        return;
+        qCWarning(KBOOKMARKS_LOG) << "Can't open " << m_bookmarksFile;
+        return false;
     }
-    d->m_doc = QDomDocument(QStringLiteral("xbel"));
-    d->m_doc.setContent(&file);
 
-    if (d->m_doc.documentElement().isNull()) {
-        qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::parse : main tag is missing, creating default " << d->m_bookmarksFile;
-        QDomElement element = d->m_doc.createElement(QStringLiteral("xbel"));
-        d->m_doc.appendChild(element);
+    QElapsedTimer timer;
+    timer.start();
+    // Only the cache and the journal need the SHA-1 of the file: without them, don't read it twice.
+    // The next save creates the cache, it gets the hash for free while writing.
+    QByteArray sourceHash;
+    if (QFile::exists(KBookmarkBinaryCache::fileName(m_bookmarksFile))
+            || QFile::exists(KBookmarkJournal::fileName(m_bookmarksFile))) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(&file);
+        sourceHash = hash.result();
     }
+    if (!sourceHash.isEmpty() && KBookmarkBinaryCache::read(m_bookmarksFile, sourceHash, tree)) {
+        qCDebug(KBOOKMARKS_LOG) << "Loaded the cache of" << m_bookmarksFile << "in" << timer.elapsed() << "ms," << tree->count() << "nodes";
+    } else {
+        file.seek(0);
+        QString errorString;
+        if (KBookmarkXbelReader::read(&file, tree, &errorString)) {
+            if (!sourceHash.isEmpty()) {
+                KBookmarkBinaryCache::write(m_bookmarksFile, sourceHash, *tree);
+            }
+        } else {
+            qCWarning(KBOOKMARKS_LOG) << "Error parsing" << m_bookmarksFile << ":" << errorString;
+        }
+        qCDebug(KBOOKMARKS_LOG) << "Parsed" << m_bookmarksFile << "in" << timer.elapsed() << "ms," << tree->count() << "nodes";
+    }
+    file.close();
 
-    QDomElement docElem = d->m_doc.documentElement();
+    // The changes saved since the file was written, see KBookmarkManager::setJournalEnabled()
+    m_fileHash = sourceHash;
+    if (KBookmarkJournal::replay(m_bookmarksFile, sourceHash, tree) > 0 && m_journalTimer) {
+        m_journalTimer->start();
+    }
+
+    if (tree->isEmpty()) {
+        qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::parse : main tag is missing, creating default " << m_bookmarksFile;
+        tree->appendElement(-1, QStringLiteral("xbel"));
+    }
 
-    QString mainTag = docElem.tagName();
+    QString mainTag = tree->tagName(tree->documentElement());
     if (mainTag != QLatin1String("xbel")) {
         qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::parse : unknown main tag " << mainTag;
     }
+    // Saved along with the next change
+    KBookmarkMigration::upgrade(tree);
+    return true;
+}
 
-    if (d->m_dbusObjectName.isNull()) {
-        d->m_dbusObjectName = docElem.attribute(QStringLiteral("dbusName"));
-    } else if (docElem.attribute(QStringLiteral("dbusName")) != d->m_dbusObjectName) {
-        docElem.setAttribute(QStringLiteral("dbusName"), d->m_dbusObjectName);
-        save();
+// Returns true if the file needs to be saved with the new name
+bool KBookmarkManagerPrivate::checkDbusName(KBookmarkTree *tree)
+{
+    const int docElem = tree->documentElement();
+    if (m_dbusObjectName.isNull()) {
+        m_dbusObjectName = tree->attribute(docElem, QStringLiteral("dbusName"));
+    } else if (tree->attribute(docElem, QStringLiteral("dbusName")) != m_dbusObjectName) {
+        tree->setAttribute(docElem, QStringLiteral("dbusName"), m_dbusObjectName);
+        return true;
     }
+    return false;
+}
 
-    QDomNode n = d->m_doc.documentElement().previousSibling();
-    if (n.isProcessingInstruction()) {
-        QDomProcessingInstruction pi = n.toProcessingInstruction();
-        pi.parentNode().removeChild(pi);
+static QVector<QDomElement> bookmarkChildren(const QDomElement &group)
+{
+    QVector<QDomElement> children;
+    for (QDomElement e = group.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+        const QString tag = e.tagName();
+        if (tag == QLatin1String("folder") || tag == QLatin1String("bookmark") || tag == QLatin1String("separator")) {
+            children.append(e);
+        }
     }
+    return children;
+}
 
-    QDomProcessingInstruction pi;
-    pi = d->m_doc.createProcessingInstruction(QStringLiteral("xml"), PI_DATA);
-    d->m_doc.insertBefore(pi, docElem);
+// Makes the document equal to tree, keeping the elements which didn't change.
+// changedGroups gets the address of every group whose list of children changed,
+// but not of groups below these.
+void KBookmarkManagerPrivate::mergeTree(const KBookmarkTree &tree, QStringList *changedGroups)
+{
+    QDomElement root = m_doc.documentElement();
+    const int rootNode = tree.documentElement();
+    // Changes with every save, not worth rebuilding everything for
+    const QString revisionAttribute = QStringLiteral(REVISION_ATTRIBUTE);
+    if (tree.hasAttribute(rootNode, revisionAttribute)) {
+        root.setAttribute(revisionAttribute, tree.attribute(rootNode, revisionAttribute));
+    } else {
+        root.removeAttribute(revisionAttribute);
+    }
+    if (tree.isSameShallowElement(rootNode, root)) {
+        mergeGroup(root, tree, rootNode, QString(), changedGroups);
+    } else {
+        rebuildGroup(root, tree, rootNode, bookmarkChildren(root));
+        changedGroups->append(QString());
+    }
+}
 
-    file.close();
+void KBookmarkManagerPrivate::mergeGroup(QDomElement &group, const KBookmarkTree &tree, int node, const QString &address, QStringList *changedGroups)
+{
+    const QVector<QDomElement> oldChildren = bookmarkChildren(group);
+    QVector<int> newChildren;
+    for (int child = tree.firstBookmark(node); child >= 0; child = tree.nextBookmark(child)) {
+        newChildren.append(child);
+    }
 
-    d->m_map.setNeedsUpdate();
+    // The title and attributes of subfolders are part of this group's listing
+    bool changed = oldChildren.count() != newChildren.count();
+    for (int i = 0; !changed && i < newChildren.count(); ++i) {
+        const int child = newChildren.at(i);
+        if (tree.bookmarkType(child) == KBookmarkTree::FolderType) {
+            changed = !tree.isSameShallowElement(child, oldChildren.at(i));
+        } else {
+            changed = !tree.isSameNode(child, oldChildren.at(i));
+        }
+    }
+
+    if (changed) {
+        rebuildGroup(group, tree, node, oldChildren);
+        changedGroups->append(address);
+        return; // the whole group gets refreshed anyway
+    }
+    for (int i = 0; i < newChildren.count(); ++i) {
+        if (tree.bookmarkType(newChildren.at(i)) == KBookmarkTree::FolderType) {
+            QDomElement folder = oldChildren.at(i);
+            mergeGroup(folder, tree, newChildren.at(i), address + QLatin1Char('/') + QString::number(i), changedGroups);
+        }
+    }
+}
+
+// Replaces the contents of group with the ones of node, reusing the old
+// children which are still the same at the same position
+void KBookmarkManagerPrivate::rebuildGroup(QDomElement &group, const KBookmarkTree &tree, int node, const QVector<QDomElement> &oldChildren)
+{
+    const QDomNamedNodeMap attributes = group.attributes();
+    for (int i = attributes.count() - 1; i >= 0; --i) {
+        const QString name = attributes.item(i).nodeName();
+        if (!tree.hasAttribute(node, name)) {
+            group.removeAttribute(name);
+        }
+    }
+    const KBookmarkTree::Node &treeNode = tree.node(node);
+    for (int i = treeNode.firstAttribute, end = treeNode.firstAttribute + treeNode.attributeCount; i < end; ++i) {
+        const KBookmarkTree::Attribute &attribute = tree.attributeAt(i);
+        group.setAttribute(tree.strings().at(attribute.name), tree.strings().at(attribute.value));
+    }
+
+    while (!group.firstChild().isNull()) {
+        group.removeChild(group.firstChild());
+    }
+
+    QVector<QDomElement> newElements;
+    int position = 0;
+    for (int child = treeNode.firstChild; child >= 0; child = tree.node(child).nextSibling) {
+        if (tree.bookmarkType(child) < KBookmarkTree::FolderType) {
+            group.appendChild(tree.toNode(m_doc, child));
+            continue;
+        }
+        if (position < oldChildren.count() && tree.isSameNode(child, oldChildren.at(position))) {
+            group.appendChild(oldChildren.at(position));
+        } else {
+            const QDomElement element = tree.toElement(m_doc, child);
+            group.appendChild(element);
+            newElements.append(element);
+        }
+        ++position;
+    }
+
+    for (const QDomElement &oldChild : oldChildren) {
+        if (oldChild.parentNode().isNull()) {
+            m_index.bookmarksRemoved(oldChild);
+        }
+    }
+    for (int i = 0; i < newElements.count(); ++i) {
+        m_index.bookmarksAdded(newElements.at(i));
+    }
+    m_index.invalidateGroup(group);
+}
+
+void KBookmarkManager::parse() const
+{
+    d->m_docIsLoaded = true;
+    // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::parse " << d->m_bookmarksFile;
+    KBookmarkTree tree;
+    if (!d->readFile(&tree)) {
+        return;
+    }
+
+    // Keep the file in compact form, the DOM is materialized from it on demand
+    d->setDocument(QDomDocument());
+    d->m_tree = tree;
+    d->m_savedGeneration = d->m_index.generation();
+    if (d->checkDbusName(&d->m_tree)) {
+        d->m_index.documentChanged();
+        save();
+    }
+}
+
+// Increases the revision of the document for the next save, and returns the
+// operations leading to it, if they can be broadcast
+bool KBookmarkManagerPrivate::prepareDelta(qulonglong *baseRevision, QByteArray *operations)
+{
+    KBookmarkOpLog &log = m_index.opLog();
+    QDomElement root = m_doc.documentElement();
+    if (!log.isEnabled() || root.isNull()) {
+        return false;
+    }
+    const QString revisionAttribute = QStringLiteral(REVISION_ATTRIBUTE);
+    *baseRevision = root.attribute(revisionAttribute).toULongLong();
+    root.setAttribute(revisionAttribute, QString::number(*baseRevision + 1));
+    const bool complete = !log.isTainted() && log.hasOperations();
+    if (complete) {
+        *operations = log.serialize();
+    }
+    log.clear();
+    return complete;
+}
+
+QStringList KBookmarkManager::reparse() const
+{
+    if (!d->m_docIsLoaded || !d->m_tree.isEmpty() || d->m_doc.documentElement().isNull()
+            || d->m_index.hasShallowFolders()) {
+        // Nothing to compare with, or not worth loading the lazily loaded folders
+        parse();
+        return QStringList(QString());
+    }
+
+    KBookmarkTree tree;
+    if (!d->readFile(&tree)) {
+        return QStringList();
+    }
+    const bool needsSave = d->checkDbusName(&tree);
+    QStringList changedGroups;
+    d->mergeTree(tree, &changedGroups);
+    d->m_index.opLog().clear(); // local changes not saved yet are gone
+    d->m_index.invalidateAll();
+    d->m_savedGeneration = needsSave ? s_notSaved : d->m_index.generation();
+    if (needsSave) {
+        save();
+    }
+    return changedGroups;
 }
 
 bool KBookmarkManager::save(bool toolbarCache) const
 {
+    if (d->isSaved() && !d->m_saveInFlight) {
+        return true; // nothing changed since
+    }
     return saveAs(d->m_bookmarksFile, toolbarCache);
 }
 
@@ -444,55 +771,153 @@ bool KBookmarkManager::saveAs(const QString &filename, bool toolbarCache) const
 {
     // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::save " << filename;
 
-    // Save the bookmark toolbar folder for quick loading
-    // but only when it will actually make things quicker
-    const QString cacheFilename = filename + QLatin1String(".tbcache");
-    if (toolbarCache && !root().isToolbarGroup()) {
-        QSaveFile cacheFile(cacheFilename);
-        if (cacheFile.open(QIODevice::WriteOnly)) {
-            QString str;
-            QTextStream stream(&str, QIODevice::WriteOnly);
-            stream << root().findToolbar();
-            const QByteArray cstr = str.toUtf8();
-            cacheFile.write(cstr.data(), cstr.length());
-            cacheFile.commit();
-        }
-    } else { // remove any (now) stale cache
-        QFile::remove(cacheFilename);
-    }
-
-    // Create parent dirs
-    QFileInfo info(filename);
-    QDir().mkpath(info.absolutePath());
-
-    QSaveFile file(filename);
-    if (file.open(QIODevice::WriteOnly)) {
-        KBackup::simpleBackupFile(file.fileName(), QString(), QStringLiteral(".bak"));
-        QTextStream stream(&file);
-        stream.setCodec(QTextCodec::codecForName("UTF-8"));
-        stream << internalDocument().toString();
-        stream.flush();
-        if (file.commit()) {
-            return true;
+    // Don't let a background write of older changes overwrite this one
+    if (d->m_saver) {
+        d->m_saver->waitForFinished();
+    }
+
+    QString errorString;
+    const QDomDocument doc = shallowDocument();
+    d->m_index.loadAll();
+    const quint64 generation = d->m_index.generation();
+    QByteArray fileHash;
+    if (kbookmarkWriteFile(filename, doc, toolbarCache, d->m_backupPolicy, &errorString, &fileHash)) {
+        if (filename == d->m_bookmarksFile) {
+            d->m_savedGeneration = generation;
+            // The operations recorded so far are in the file now, but were never
+            // broadcast: the next delta can't describe them, and the journal
+            // mustn't record them again, so the other processes have to reparse
+            KBookmarkOpLog &log = d->m_index.opLog();
+            if (log.hasOperations()) {
+                log.setTainted();
+            }
+            d->m_fileHash = fileHash;
+            if (d->m_journalEnabled && !QFile::exists(KBookmarkJournal::fileName(filename))) {
+                KBookmarkJournal::reset(filename, fileHash);
+            }
         }
+        return true;
     }
+    reportSaveError(filename, errorString);
+    return false;
+}
 
+void KBookmarkManager::reportSaveError(const QString &filename, const QString &errorString) const
+{
     static int hadSaveError = false;
     if (!hadSaveError) {
         QString err = tr("Unable to save bookmarks in %1. Reported error was: %2. "
                          "This error message will only be shown once. The cause "
                          "of the error needs to be fixed as quickly as possible, "
-                         "which is most likely a full hard drive.").arg(filename).arg(file.errorString());
+                         "which is most likely a full hard drive.").arg(filename).arg(errorString);
 
         if (d->m_dialogAllowed && qobject_cast<QApplication *>(qApp) && QThread::currentThread() == qApp->thread()) {
             QMessageBox::critical(QApplication::activeWindow(), QApplication::applicationName(), err);
         }
 
-        qCCritical(KBOOKMARKS_LOG) << QStringLiteral("Unable to save bookmarks in %1. File reported the following error-code: %2.").arg(filename).arg(file.error());
+        qCCritical(KBOOKMARKS_LOG) << QStringLiteral("Unable to save bookmarks in %1. File reported the following error: %2.").arg(filename).arg(errorString);
         emit const_cast<KBookmarkManager *>(this)->error(err);
     }
     hadSaveError = true;
-    return false;
+}
+
+void KBookmarkManager::setSaveDelay(int msec)
+{
+    d->m_saveDelay = qMax(0, msec);
+    if (d->m_saveDelay > 0 && !d->m_saver) {
+        d->m_saveTimer = new QTimer(this);
+        d->m_saveTimer->setSingleShot(true);
+        connect(d->m_saveTimer, &QTimer::timeout, this, &KBookmarkManager::startDelayedSave);
+        d->m_saver = new KBookmarkSaver;
+        // queued: finished() is emitted from the worker thread
+        connect(d->m_saver, &KBookmarkSaver::finished, this, &KBookmarkManager::finishDelayedSave, Qt::QueuedConnection);
+    }
+    if (d->m_saveDelay == 0 && d->m_hasPendingSave) {
+        flush();
+    }
+}
+
+int KBookmarkManager::saveDelay() const
+{
+    return d->m_saveDelay;
+}
+
+void KBookmarkManager::startDelayedSave()
+{
+    if (!d->m_hasPendingSave || d->m_saveInFlight) {
+        return; // finishDelayedSave() comes back here
+    }
+    if (d->m_transactionDepth > 0) {
+        return; // commitTransaction() or rollbackTransaction() comes back here
+    }
+    d->m_hasPendingSave = false;
+    d->m_saveInFlight = true;
+    d->m_writingAddress = d->m_pendingAddress;
+    d->m_writingGroupId = d->m_writingAddress.isEmpty() ? QString() : findByAddress(d->m_writingAddress).id();
+    d->m_pendingAddress.clear();
+    d->m_writingHasDelta = d->prepareDelta(&d->m_writingBaseRevision, &d->m_writingOperations);
+    // The DOM isn't thread-safe, the worker gets its own copy
+    const QDomDocument doc = shallowDocument();
+    d->m_index.loadAll();
+    d->m_writingGeneration = d->m_index.generation();
+    d->m_saver->start(d->m_bookmarksFile, doc.cloneNode(true).toDocument(), d->m_backupPolicy);
+}
+
+void KBookmarkManager::finishDelayedSave(bool success, const QString &errorString)
+{
+    if (d->m_handledSaveResults > 0) {
+        --d->m_handledSaveResults; // already handled by flush()
+        return;
+    }
+    d->m_saveInFlight = false;
+    if (success) {
+        d->m_savedGeneration = d->m_writingGeneration;
+    } else {
+        reportSaveError(d->m_bookmarksFile, errorString);
+    }
+    emit saveFinished(success);
+
+    // Only now can the other processes read the changes
+    const QString address = d->m_writingAddress;
+    const QString groupId = d->m_writingGroupId;
+    d->m_writingAddress.clear();
+    d->m_writingGroupId.clear();
+    if (success && d->m_writingHasDelta) {
+        emit bookmarksDelta(d->m_writingBaseRevision, d->m_writingBaseRevision + 1, d->m_writingOperations);
+    }
+    d->m_writingHasDelta = false;
+    d->m_writingOperations.clear();
+    emit bookmarksChanged(address);
+    emit bookmarksChangedWithId(address, groupId);
+
+    if (d->m_hasPendingSave && !d->m_saveTimer->isActive()) {
+        d->m_saveTimer->start(d->m_saveDelay);
+    }
+}
+
+bool KBookmarkManager::flush()
+{
+    if (!d->m_saver) {
+        return true;
+    }
+    d->m_saveTimer->stop();
+    bool success = true;
+    if (d->m_saveInFlight) {
+        QString errorString;
+        success = d->m_saver->waitForFinished(&errorString);
+        finishDelayedSave(success, errorString);
+        ++d->m_handledSaveResults;
+    }
+    if (d->m_hasPendingSave) {
+        d->m_hasPendingSave = false;
+        const QString address = d->m_pendingAddress;
+        d->m_pendingAddress.clear();
+        const bool saved = saveAndBroadcast(address);
+        emit saveFinished(saved);
+        success = success && saved;
+    }
+    d->m_saveTimer->stop(); // possibly restarted by finishDelayedSave()
+    return success;
 }
 
 QString KBookmarkManager::path() const
@@ -502,7 +927,7 @@ QString KBookmarkManager::path() const
 
 KBookmarkGroup KBookmarkManager::root() const
 {
-    return KBookmarkGroup(internalDocument().documentElement());
+    return KBookmarkGroup(shallowDocument().documentElement());
 }
 
 KBookmarkGroup KBookmarkManager::toolbar()
@@ -539,7 +964,7 @@ KBookmarkGroup KBookmarkManager::toolbar()
     if (elem.isNull()) {
         // Root is the bookmark toolbar if none has been set.
         // Make it explicit to speed up invocations of findToolbar()
-        root().internalElement().setAttribute(QStringLiteral("toolbar"), QStringLiteral("yes"));
+        shallowDocument().documentElement().setAttribute(QStringLiteral("toolbar"), QStringLiteral("yes"));
         return root();
     } else {
         return KBookmarkGroup(elem);
@@ -549,30 +974,31 @@ KBookmarkGroup KBookmarkManager::toolbar()
 KBookmark KBookmarkManager::findByAddress(const QString &address)
 {
     // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::findByAddress " << address;
-    KBookmark result = root();
-    // The address is something like /5/10/2+
-    const QStringList addresses = address.split(QRegularExpression(QStringLiteral("[/+]")), QString::SkipEmptyParts);
-    // qCWarning(KBOOKMARKS_LOG) << addresses.join(",");
-    for (QStringList::const_iterator it = addresses.begin(); it != addresses.end();) {
-        bool append = ((*it) == QLatin1String("+"));
-        uint number = (*it).toUInt();
-        Q_ASSERT(result.isGroup());
-        KBookmarkGroup group = result.toGroup();
-        KBookmark bk = group.first(), lbk = bk; // last non-null bookmark
-        for (uint i = 0; ((i < number) || append) && !bk.isNull(); ++i) {
-            lbk = bk;
-            bk = group.next(bk);
-            // qCWarning(KBOOKMARKS_LOG) << i;
+    const QDomElement rootElement = shallowDocument().documentElement();
+    const quint64 generation = d->m_index.structureGeneration();
+    if (generation != d->m_addressCacheGeneration) {
+        d->m_addressCache.clear();
+        d->m_addressCacheGeneration = generation;
+    } else {
+        const QHash<QString, QDomElement>::const_iterator it = d->m_addressCache.constFind(address);
+        if (it != d->m_addressCache.constEnd()) {
+            return KBookmark(it.value());
         }
-        it++;
-        // qCWarning(KBOOKMARKS_LOG) << "found section";
-        result = bk;
+    }
+
+    // The address is something like /5/10/2+
+    const KBookmarkAddress parsed = KBookmarkAddress::fromString(address);
+    QDomElement result = rootElement;
+    for (int level = 0; level < parsed.depth() && !result.isNull(); ++level) {
+        result = d->m_index.child(result, parsed.at(level));
     }
     if (result.isNull()) {
         qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::findByAddress: couldn't find item " << address;
+    } else {
+        d->m_addressCache.insert(address, result);
     }
     // qCWarning(KBOOKMARKS_LOG) << "found " << result.address();
-    return result;
+    return KBookmark(result);
 }
 
 void KBookmarkManager::emitChanged()
@@ -580,19 +1006,309 @@ void KBookmarkManager::emitChanged()
     emitChanged(root());
 }
 
-void KBookmarkManager::emitChanged(const KBookmarkGroup &group)
+// The innermost element containing both a and b
+static QDomElement commonAncestor(const QDomElement &a, const QDomElement &b)
 {
-    (void) save(); // KDE5 TODO: emitChanged should return a bool? Maybe rename it to saveAndEmitChanged?
+    QVector<QDomNode> ancestors;
+    for (QDomNode node = a; !node.isNull(); node = node.parentNode()) {
+        ancestors.append(node);
+    }
+    for (QDomNode node = b; !node.isNull(); node = node.parentNode()) {
+        if (node.isElement() && ancestors.contains(node)) {
+            return node.toElement();
+        }
+    }
+    return QDomElement();
+}
 
-    // Tell the other processes too
-    // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::emitChanged : broadcasting change " << group.address();
+void KBookmarkManager::emitChanged(const KBookmarkGroup &group)
+{
+    if (d->m_transactionDepth > 0) {
+        // Saved and broadcast once by commitTransaction()
+        const QDomElement element = kbookmarkElement(group);
+        d->m_transactionGroup = d->m_transactionChanged ? commonAncestor(d->m_transactionGroup, element) : element;
+        d->m_transactionChanged = true;
+        return;
+    }
 
-    emit bookmarksChanged(group.address());
+    (void) storeChanges(group); // KDE5 TODO: emitChanged should return a bool? Maybe rename it to saveAndEmitChanged?
 
     // We do get our own broadcast, so no need for this anymore
     //emit changed( group );
 }
 
+bool KBookmarkManager::storeChanges(const KBookmarkGroup &group)
+{
+    // In case the children of group were modified through the DOM directly
+    const QDomElement groupElement = kbookmarkElement(group);
+    d->m_index.ensureSubtreeLoaded(groupElement);
+    if (d->m_index.takeDirectAccess()) {
+        // Anything may have changed, and the operations recorded can't describe it
+        d->m_index.opLog().setTainted();
+        d->m_index.invalidateAll();
+    }
+    d->m_index.invalidateGroup(groupElement);
+    d->m_index.bookmarksAdded(groupElement);
+
+    if (d->m_saveDelay > 0 && !d->m_journalEnabled) {
+        const QString address = group.address();
+        d->m_pendingAddress = d->m_hasPendingSave ? KBookmark::commonParent(d->m_pendingAddress, address) : address;
+        d->m_hasPendingSave = true;
+        // Not restarted on every change, so that a stream of changes still gets saved
+        if (!d->m_saveTimer->isActive() && !d->m_saveInFlight) {
+            d->m_saveTimer->start(d->m_saveDelay);
+        }
+        return true;
+    }
+
+    return saveAndBroadcast(group.address());
+}
+
+void KBookmarkManager::beginTransaction()
+{
+    if (d->m_transactionDepth++ > 0) {
+        return;
+    }
+    // The lazily loaded folders are part of what rollbackTransaction() restores
+    const QDomDocument doc = shallowDocument();
+    d->m_index.loadAll();
+    d->m_transactionBackup = doc.cloneNode(true).toDocument();
+    d->m_transactionGeneration = d->m_index.generation();
+    d->m_transactionChanged = false;
+    d->m_transactionGroup = QDomElement();
+}
+
+bool KBookmarkManager::commitTransaction()
+{
+    if (d->m_transactionDepth == 0) {
+        qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::commitTransaction: no transaction";
+        return false;
+    }
+    if (--d->m_transactionDepth > 0) {
+        return true;
+    }
+    d->m_transactionBackup = QDomDocument();
+    bool success = true;
+    if (d->m_transactionChanged) {
+        d->m_transactionChanged = false;
+        // Falls back to the root if the group was deleted afterwards
+        QDomElement group = d->m_transactionGroup;
+        if (group.isNull() || !KBookmarkOpLog::isInDocument(group)) {
+            group = kbookmarkElement(root());
+        }
+        d->m_transactionGroup = QDomElement();
+        success = storeChanges(KBookmarkGroup(group));
+    }
+    // Delayed saves of the changes from before were held back
+    if (d->m_hasPendingSave && !d->m_saveTimer->isActive() && !d->m_saveInFlight) {
+        d->m_saveTimer->start(d->m_saveDelay);
+    }
+    return success;
+}
+
+void KBookmarkManager::rollbackTransaction()
+{
+    if (d->m_transactionDepth == 0) {
+        qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::rollbackTransaction: no transaction";
+        return;
+    }
+    d->m_transactionDepth = 0;
+    d->m_transactionChanged = false;
+    d->m_transactionGroup = QDomElement();
+    d->setDocument(d->m_transactionBackup);
+    d->m_transactionBackup = QDomDocument();
+    const bool wasSaved = d->m_savedGeneration == d->m_transactionGeneration;
+    d->m_index.documentChanged();
+    if (wasSaved) {
+        d->m_savedGeneration = d->m_index.generation();
+    }
+    d->m_addressCache.clear();
+    if (d->m_hasPendingSave) {
+        // The operations leading to the pending changes are gone
+        d->m_index.opLog().setTainted();
+        if (!d->m_saveTimer->isActive() && !d->m_saveInFlight) {
+            d->m_saveTimer->start(d->m_saveDelay);
+        }
+    }
+    // Nothing was saved or broadcast, only this process has to reload
+    emit changed(QString(), QString());
+}
+
+bool KBookmarkManager::saveAndBroadcast(const QString &groupAddress)
+{
+    // Still broadcast, as callers rely on the changed() signal coming back
+    const bool unchanged = d->isSaved() && !d->m_saveInFlight;
+    // Only the id the group has already: creating one would be a change to save
+    const QString groupId = groupAddress.isEmpty() ? QString() : kbookmarkElement(findByAddress(groupAddress)).attribute(QStringLiteral("id"));
+    qulonglong baseRevision = 0;
+    QByteArray operations;
+    const bool hasDelta = !unchanged && d->prepareDelta(&baseRevision, &operations);
+    const bool saved = unchanged || (hasDelta && appendJournal(baseRevision, operations)) || save();
+
+    // Tell the other processes too
+    // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::emitChanged : broadcasting change " << groupAddress;
+
+    // Before bookmarksChanged(), which tells the processes which couldn't apply it to reparse
+    if (saved && hasDelta) {
+        emit bookmarksDelta(baseRevision, baseRevision + 1, operations);
+    }
+    emit bookmarksChanged(groupAddress);
+    emit bookmarksChangedWithId(groupAddress, groupId);
+    return saved;
+}
+
+bool KBookmarkManager::appendJournal(qulonglong baseRevision, const QByteArray &operations)
+{
+    if (!d->m_journalEnabled) {
+        return false;
+    }
+    const quint64 generation = d->m_index.generation();
+    qint64 size = 0;
+    if (!KBookmarkJournal::append(d->m_bookmarksFile, d->m_fileHash, baseRevision, operations, &size)) {
+        return false; // saved to the file instead, which starts a new journal
+    }
+    d->m_savedGeneration = generation;
+    if (size > d->m_journalThreshold) {
+        (void) compactJournal();
+    } else {
+        d->m_journalTimer->start();
+    }
+    return true;
+}
+
+void KBookmarkManager::setJournalEnabled(bool enable)
+{
+    if (enable == d->m_journalEnabled || d->m_bookmarksFile.isEmpty()) {
+        return;
+    }
+    flush();
+    if (enable) {
+        // The journal records the operations from here on
+        if (!d->isSaved()) {
+            save();
+        }
+        d->m_index.opLog().setEnabled(true);
+        if (!d->m_journalTimer) {
+            d->m_journalTimer = new QTimer(this);
+            d->m_journalTimer->setSingleShot(true);
+            d->m_journalTimer->setInterval(s_journalIdleDelay);
+            connect(d->m_journalTimer, &QTimer::timeout, this, &KBookmarkManager::compactJournal);
+        }
+        d->m_journalEnabled = true;
+    } else {
+        d->m_journalEnabled = false;
+        d->m_index.opLog().setEnabled(d->m_dbusRegistered);
+        (void) compactJournal();
+    }
+}
+
+bool KBookmarkManager::isJournalEnabled() const
+{
+    return d->m_journalEnabled;
+}
+
+void KBookmarkManager::setJournalCompactionThreshold(qint64 bytes)
+{
+    d->m_journalThreshold = qMax(qint64(0), bytes);
+}
+
+qint64 KBookmarkManager::journalCompactionThreshold() const
+{
+    return d->m_journalThreshold;
+}
+
+bool KBookmarkManager::compactJournal()
+{
+    if (d->m_journalTimer) {
+        d->m_journalTimer->stop();
+    }
+    const QString journalFile = KBookmarkJournal::fileName(d->m_bookmarksFile);
+    if (d->m_bookmarksFile.isEmpty() || (!d->m_journalEnabled && !QFile::exists(journalFile))) {
+        return true;
+    }
+    flush();
+    if (!saveAs(d->m_bookmarksFile)) {
+        return false;
+    }
+    if (!d->m_journalEnabled) {
+        QFile::remove(journalFile);
+    }
+    return true;
+}
+
+void KBookmarkManager::setBackupGenerations(int count)
+{
+    d->m_backupPolicy.generations = qMax(0, count);
+}
+
+int KBookmarkManager::backupGenerations() const
+{
+    return d->m_backupPolicy.generations;
+}
+
+void KBookmarkManager::setBackupMaxAge(int days)
+{
+    d->m_backupPolicy.maxAge = qMax(0, days);
+}
+
+int KBookmarkManager::backupMaxAge() const
+{
+    return d->m_backupPolicy.maxAge;
+}
+
+void KBookmarkManager::setBackupInterval(int seconds)
+{
+    d->m_backupPolicy.minInterval = qMax(0, seconds);
+}
+
+int KBookmarkManager::backupInterval() const
+{
+    return d->m_backupPolicy.minInterval;
+}
+
+QStringList KBookmarkManager::availableBackups() const
+{
+    return KBookmarkBackup::list(d->m_bookmarksFile);
+}
+
+QDateTime KBookmarkManager::backupTime(const QString &backupFile)
+{
+    return KBookmarkBackup::time(backupFile);
+}
+
+bool KBookmarkManager::restoreBackup(const QString &backupFile)
+{
+    if (d->m_transactionDepth > 0 || !availableBackups().contains(backupFile)) {
+        qCWarning(KBOOKMARKS_LOG) << "KBookmarkManager::restoreBackup: not a backup of" << d->m_bookmarksFile << ":" << backupFile;
+        return false;
+    }
+    QFile file(backupFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(KBOOKMARKS_LOG) << "Can't open" << backupFile;
+        return false;
+    }
+    KBookmarkTree tree;
+    QString errorString;
+    if (!KBookmarkXbelReader::read(&file, &tree, &errorString) || tree.isEmpty()) {
+        qCWarning(KBOOKMARKS_LOG) << "Error parsing" << backupFile << ":" << errorString;
+        return false;
+    }
+    KBookmarkMigration::upgrade(&tree);
+    d->checkDbusName(&tree);
+    flush();
+
+    // Same as reading the file, but the current version is backed up and replaced
+    d->setDocument(QDomDocument());
+    d->m_tree = tree;
+    d->m_docIsLoaded = true;
+    d->m_toolbarDoc.clear();
+    d->m_addressCache.clear();
+    d->m_index.documentChanged();
+    // The other processes reload everything
+    d->m_index.opLog().setTainted();
+    return saveAndBroadcast(QString());
+}
+
 void KBookmarkManager::emitConfigChanged()
 {
     emit bookmarkConfigChanged();
@@ -606,11 +1322,11 @@ void KBookmarkManager::notifyCompleteChange(const QString &caller)   // DBUS cal
 
     // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::notifyCompleteChange";
     // The bk editor tells us we should reload everything
-    // Reparse
-    parse();
-    // Tell our GUI
-    // (emit where group is "" to directly mark the root menu as dirty)
-    emit changed(QLatin1String(""), caller);
+    // Reparse, and tell our GUI about the groups which changed
+    const QStringList changedGroups = reparse();
+    for (const QString &groupAddress : changedGroups) {
+        emit changed(groupAddress, caller);
+    }
 }
 
 void KBookmarkManager::notifyConfigChanged() // DBUS call
@@ -631,7 +1347,23 @@ void KBookmarkManager::notifyChanged(const QString &groupAddress, const QDBusMes
     // Reparse (the whole file, no other choice)
     // if someone else notified us
     if (msg.service() != QDBusConnection::sessionBus().baseService()) {
-        parse();
+        if (!d->m_appliedDeltaSender.isEmpty() && d->m_appliedDeltaSender == msg.service()) {
+            // Up to date already, see notifyDelta()
+            const QStringList changedGroups = d->m_appliedDeltaGroups;
+            d->m_appliedDeltaSender.clear();
+            d->m_appliedDeltaGroups.clear();
+            for (const QString &changedGroup : changedGroups) {
+                emit changed(changedGroup, QString());
+            }
+            return;
+        }
+        d->m_appliedDeltaSender.clear();
+        d->m_appliedDeltaGroups.clear();
+        const QStringList changedGroups = reparse();
+        for (const QString &changedGroup : changedGroups) {
+            emit changed(changedGroup, QString());
+        }
+        return;
     }
 
     // qCDebug(KBOOKMARKS_LOG) << "KBookmarkManager::notifyChanged " << groupAddress;
@@ -640,6 +1372,41 @@ void KBookmarkManager::notifyChanged(const QString &groupAddress, const QDBusMes
     emit changed(groupAddress, QString());
 }
 
+void KBookmarkManager::notifyDelta(qulonglong baseRevision, qulonglong revision, const QByteArray &operations, const QDBusMessage &msg)   // DBUS call
+{
+    if (!d->m_update || msg.service() == QDBusConnection::sessionBus().baseService()) {
+        return;
+    }
+    d->m_appliedDeltaSender.clear();
+    d->m_appliedDeltaGroups.clear();
+
+    // The operations only make sense on the document they were recorded on,
+    // anything else is left to the reparse triggered by bookmarksChanged()
+    if (!d->m_docIsLoaded || !d->m_tree.isEmpty() || d->m_hasPendingSave || d->m_saveInFlight
+            || d->m_index.opLog().hasOperations()) {
+        return;
+    }
+    QDomElement root = d->m_doc.documentElement();
+    if (root.isNull() || root.attribute(QStringLiteral(REVISION_ATTRIBUTE)).toULongLong() != baseRevision) {
+        return;
+    }
+
+    const bool wasSaved = d->isSaved();
+    QStringList changedGroups;
+    if (!KBookmarkOpLog::apply(operations, d->m_doc, &d->m_index, &changedGroups)) {
+        qCWarning(KBOOKMARKS_LOG) << "Could not apply the changes sent by" << msg.service() << ", rereading" << d->m_bookmarksFile;
+        d->m_index.opLog().clear();
+        return;
+    }
+    root.setAttribute(QStringLiteral(REVISION_ATTRIBUTE), QString::number(revision));
+    d->m_index.opLog().clear();
+    if (wasSaved) {
+        d->m_savedGeneration = d->m_index.generation(); // same as the file written by the sender
+    }
+    d->m_appliedDeltaSender = msg.service();
+    d->m_appliedDeltaGroups = changedGroups;
+}
+
 void KBookmarkManager::setEditorOptions(const QString &caption, bool browser)
 {
     d->m_editorCaption = caption;
@@ -680,15 +1447,67 @@ void KBookmarkManager::slotEditBookmarksAtAddress(const QString &address)
 }
 
 ///////
+KBookmark::List KBookmarkManager::findByUrl(const QUrl &url) const
+{
+    (void) root(); // make sure the document is loaded
+    KBookmark::List result;
+    const QList<QDomElement> elements = d->m_index.bookmarksForUrl(url);
+    for (const QDomElement &elem : elements) {
+        result.append(KBookmark(elem));
+    }
+    return result;
+}
+
+KBookmark KBookmarkManager::findById(const QString &id) const
+{
+    if (id.isEmpty()) {
+        return KBookmark();
+    }
+    (void) root(); // make sure the document is loaded
+    return KBookmark(d->m_index.elementForId(id));
+}
+
+quint64 KBookmarkManager::generation() const
+{
+    return d->m_index.generation();
+}
+
+KBookmarkSnapshot KBookmarkManager::snapshot() const
+{
+    if (!d->m_docIsLoaded) {
+        parse();
+    }
+    // Straight from the parsed file, as long as nobody needed the DOM yet
+    if (!d->m_tree.isEmpty()) {
+        return KBookmarkSnapshot(KBookmarkSnapshotNode::fromTree(d->m_tree, d->m_tree.documentElement()).data());
+    }
+    return KBookmarkSnapshot(root());
+}
+
+bool KBookmarkManager::isBookmarked(const QUrl &url) const
+{
+    (void) root();
+    return !d->m_index.bookmarksForUrl(url).isEmpty();
+}
+
+int KBookmarkManager::iconCacheHits() const
+{
+    return d->m_index.iconCacheHits();
+}
+
+int KBookmarkManager::iconCacheMisses() const
+{
+    return d->m_index.iconCacheMisses();
+}
+
 bool KBookmarkManager::updateAccessMetadata(const QString &url)
 {
-    d->m_map.update(this);
-    QList<KBookmark> list = d->m_map.find(url);
+    KBookmark::List list = findByUrl(QUrl(url));
     if (list.count() == 0) {
         return false;
     }
 
-    for (QList<KBookmark>::iterator it = list.begin();
+    for (KBookmark::List::iterator it = list.begin();
             it != list.end(); ++it) {
         (*it).updateAccessMetadata();
     }
@@ -696,11 +1515,55 @@ bool KBookmarkManager::updateAccessMetadata(const QString &url)
     return true;
 }
 
+bool KBookmarkManager::compactAccessStatistics()
+{
+    if (!d->m_accessStats) {
+        return true;
+    }
+    d->m_accessStats->refresh();
+    const QHash<QString, KBookmarkAccessStats::Entry> entries = d->m_accessStats->entries();
+    if (entries.isEmpty()) {
+        d->m_accessStats->discardRead();
+        return true;
+    }
+
+    // Move the values into the XBEL metadata, past the store which shadows it
+    d->m_index.setAccessStats(nullptr);
+    const QDomDocument doc = shallowDocument();
+    d->m_index.loadAll();
+    QVector<QDomElement> pending;
+    pending.append(doc.documentElement());
+    while (!pending.isEmpty()) {
+        const QDomElement group = pending.takeLast();
+        for (QDomElement e = group.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+            if (e.tagName() == QLatin1String("folder")) {
+                pending.append(e);
+            } else if (e.tagName() != QLatin1String("bookmark")) {
+                continue;
+            }
+            QHash<QString, KBookmarkAccessStats::Entry>::const_iterator it = entries.constFind(e.attribute(QStringLiteral("id")));
+            if (it != entries.constEnd()) {
+                KBookmark bookmark(e);
+                bookmark.setMetaDataItem(QStringLiteral("time_added"), it.value().timeAdded);
+                bookmark.setMetaDataItem(QStringLiteral("time_visited"), it.value().timeVisited);
+                bookmark.setMetaDataItem(QStringLiteral("visit_count"), QString::number(it.value().visitCount));
+            }
+        }
+    }
+    d->m_index.setAccessStats(d->m_accessStats);
+    flush(); // the changes before these ones
+    if (!saveAndBroadcast(QString())) {
+        return false; // still in the store until the bookmark file can be written
+    }
+    // Only what was moved: other processes may have recorded visits since
+    d->m_accessStats->discardRead();
+    return true;
+}
+
 void KBookmarkManager::updateFavicon(const QString &url, const QString &/*faviconurl*/)
 {
-    d->m_map.update(this);
-    QList<KBookmark> list = d->m_map.find(url);
-    for (QList<KBookmark>::iterator it = list.begin();
+    KBookmark::List list = findByUrl(QUrl(url));
+    for (KBookmark::List::iterator it = list.begin();
             it != list.end(); ++it) {
         // TODO - update favicon data based on faviconurl
         //        but only when the previously used icon
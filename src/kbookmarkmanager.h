@@ -24,12 +24,14 @@
 #include <QDomDocument>
 #include <QDomElement>
 class KBookmarkManagerPrivate;
+class KBookmarkSnapshot;
 
 #include "kbookmark.h"
 #include "kbookmarkowner.h" // for SC reasons
 
 class KBookmarkGroup;
 class QDBusMessage;
+class QDateTime;
 
 class KBookmarkDialog;
 
@@ -142,6 +144,19 @@ public:
      */
     bool updateAccessMetadata(const QString &url);
 
+    /**
+     * The access metadata updated by updateAccessMetadata() and
+     * KBookmark::updateAccessMetadata() is stored next to the bookmark file
+     * (as "<file>.stats"), so that visiting a page doesn't rewrite the whole
+     * bookmark file. metaDataItem() returns the values from there.
+     *
+     * This writes them into the metadata of the bookmark file, saves it
+     * and removes the separate file.
+     * @return false if the bookmark file couldn't be written
+     * @since 5.50
+     */
+    bool compactAccessStatistics();
+
     /*
      * NB. currently *unimplemented*
      *
@@ -183,6 +198,73 @@ public:
      */
     KBookmark findByAddress(const QString &address);
 
+    /**
+     * @return all bookmarks pointing to @p url
+     *
+     * This uses an index which follows the changes done through the
+     * KBookmark API, so it is cheap enough to be called on every page load.
+     * @since 5.50
+     */
+    KBookmark::List findByUrl(const QUrl &url) const;
+
+    /**
+     * @return the bookmark or folder with the given KBookmark::id(),
+     * a null bookmark if there is none
+     *
+     * Unlike addresses, ids stay valid when bookmarks are added, moved or
+     * removed elsewhere, so they can be kept to find a bookmark again.
+     * @since 5.50
+     */
+    KBookmark findById(const QString &id) const;
+
+    /**
+     * @return a read-only copy of all bookmarks, which other threads
+     * can use while the bookmarks are edited (include kbookmarksnapshot.h)
+     *
+     * Only the folders and bookmarks changed since the last snapshot, and
+     * the folders containing them, are copied: everything else is shared
+     * with the previous snapshots. Calling this after every change is cheap.
+     * @since 5.50
+     */
+    KBookmarkSnapshot snapshot() const;
+
+    /**
+     * @return a number increased by every change to the bookmarks: through
+     * the KBookmark and KBookmarkGroup API, by other processes, or possibly
+     * through KBookmark::internalElement() and internalDocument(), once
+     * reported by emitChanged()
+     *
+     * Caches built from the bookmarks are valid as long as it is the same.
+     * save() doesn't write the file if it didn't change since the file was
+     * read or written last.
+     * @since 5.50
+     */
+    quint64 generation() const;
+
+    /**
+     * @return true if at least one bookmark points to @p url
+     * @see findByUrl
+     * @since 5.50
+     */
+    bool isBookmarked(const QUrl &url) const;
+
+    /**
+     * KBookmark::icon() looks up the icon of bookmarks without an explicit
+     * one in the mime database, by mime type or URL, and caches the results
+     * for the bookmarks of this manager.
+     * @return how many icons were found in the cache so far
+     * @see iconCacheMisses
+     * @since 5.50
+     */
+    int iconCacheHits() const;
+
+    /**
+     * @return how many icons had to be looked up in the mime database so far
+     * @see iconCacheHits
+     * @since 5.50
+     */
+    int iconCacheMisses() const;
+
     /**
      * Saves the bookmark file and notifies everyone.
      *
@@ -195,17 +277,218 @@ public:
      */
     void emitChanged(const KBookmarkGroup &group);
 
+    /**
+     * Starts a batch of changes. Until commitTransaction(), emitChanged()
+     * only remembers the changed groups: the changes are then saved and
+     * broadcast once, for the common parent of all of them.
+     *
+     * \code
+     * manager->beginTransaction();
+     * for (const KBookmark &bookmark : bookmarks) {
+     *     group.deleteBookmark(bookmark);
+     *     manager->emitChanged(group);
+     * }
+     * manager->commitTransaction();
+     * \endcode
+     *
+     * Transactions can be nested, only the outermost one saves.
+     * @see rollbackTransaction
+     * @since 5.50
+     */
+    void beginTransaction();
+
+    /**
+     * Ends the transaction started by beginTransaction(), saving and
+     * broadcasting the changes if it was the outermost one.
+     * @return false if saving failed, or if there was no transaction
+     * @since 5.50
+     */
+    bool commitTransaction();
+
+    /**
+     * Ends the current transaction, and all the ones it is nested in,
+     * restoring the bookmarks as they were in beginTransaction().
+     * This replaces the whole document: all KBookmark and KBookmarkGroup
+     * objects are invalid then, and changed() is emitted for the root group.
+     * @since 5.50
+     */
+    void rollbackTransaction();
+
     /**
      * Save the bookmarks to an XML file on disk.
      * You should use emitChanged() instead of this function, it saves
      * and notifies everyone that the file has changed.
      * Only use this if you don't want the emitChanged signal.
+     * Since 5.50, the file isn't written again if nothing changed since
+     * it was read or written last, see generation().
      * @param toolbarCache iff true save a cache of the toolbar folder, too
      * @return true if saving was successful
      */
     // KF6 TODO: Use an enum and not a bool
     bool save(bool toolbarCache = true) const;
 
+    /**
+     * Makes emitChanged() write the file in the background instead of
+     * before returning: changes are collected for @p msec milliseconds, then
+     * a copy of the document is saved in a worker thread, and other processes
+     * are notified once the file is written. This avoids rewriting the
+     * whole file over and over again during bulk changes.
+     *
+     * A delay of 0 (the default) saves synchronously, as before.
+     * @see flush, saveFinished
+     * @since 5.50
+     */
+    void setSaveDelay(int msec);
+
+    /**
+     * @return the delay set with setSaveDelay()
+     * @since 5.50
+     */
+    int saveDelay() const;
+
+    /**
+     * Writes pending changes right away and waits for the write to finish.
+     * Call this before quitting when using setSaveDelay().
+     * @return false if saving failed
+     * @since 5.50
+     */
+    bool flush();
+
+    /**
+     * In journal mode, emitChanged() doesn't rewrite the whole file: the
+     * changes are appended to "\<file\>.journal" as compact records, each of
+     * them with a single write flushed to the disk. Loading the file replays
+     * the journal, whether journal mode is enabled or not.
+     *
+     * The journal is compacted into the file once it exceeds
+     * journalCompactionThreshold(), or when no change was saved for a while.
+     * Changes which can't be recorded, e.g. through internalDocument(),
+     * are still saved to the file directly. setSaveDelay() doesn't apply
+     * in journal mode, appending is cheap enough.
+     *
+     * Disabling journal mode compacts the journal and removes it.
+     * @see compactJournal
+     * @since 5.50
+     */
+    void setJournalEnabled(bool enable);
+
+    /**
+     * @return whether journal mode is enabled, see setJournalEnabled()
+     * @since 5.50
+     */
+    bool isJournalEnabled() const;
+
+    /**
+     * Sets the size of the journal in bytes beyond which it gets compacted
+     * into the file. The default is 512 KiB.
+     * @since 5.50
+     */
+    void setJournalCompactionThreshold(qint64 bytes);
+
+    /**
+     * @return the size set with setJournalCompactionThreshold()
+     * @since 5.50
+     */
+    qint64 journalCompactionThreshold() const;
+
+    /**
+     * Writes the whole file, including the changes in the journal, and
+     * starts an empty journal.
+     * @return false if saving failed
+     * @since 5.50
+     */
+    bool compactJournal();
+
+    /**
+     * Sets how many versions of the file are kept as backups, each time
+     * before it is written. The default is 1, 0 disables backups.
+     *
+     * With the default, the previous version is kept as "<file>.bak", as in
+     * older versions. Otherwise, and as soon as setBackupInterval() is used,
+     * backups are named after the time they were taken, and "<file>.bak" is
+     * left alone. Backups don't copy the file where possible: they are
+     * copy-on-write clones on file systems supporting them, or hard links
+     * to the version being replaced.
+     * @see setBackupMaxAge, setBackupInterval, availableBackups
+     * @since 5.50
+     */
+    void setBackupGenerations(int count);
+
+    /**
+     * @return the number set with setBackupGenerations()
+     * @since 5.50
+     */
+    int backupGenerations() const;
+
+    /**
+     * Removes the backups older than @p days, except for the newest one.
+     * The default is 0, for no limit.
+     * @since 5.50
+     */
+    void setBackupMaxAge(int days);
+
+    /**
+     * @return the age set with setBackupMaxAge()
+     * @since 5.50
+     */
+    int backupMaxAge() const;
+
+    /**
+     * Sets the minimum time between two backups: saving within @p seconds
+     * after the last backup doesn't take a new one. The default is 0.
+     * @since 5.50
+     */
+    void setBackupInterval(int seconds);
+
+    /**
+     * @return the interval set with setBackupInterval()
+     * @since 5.50
+     */
+    int backupInterval() const;
+
+    /**
+     * @return the backup files of the bookmark file, the newest first
+     * @see backupTime, restoreBackup
+     * @since 5.50
+     */
+    QStringList availableBackups() const;
+
+    /**
+     * @return when @p backupFile, one of availableBackups(), was taken
+     * @since 5.50
+     */
+    static QDateTime backupTime(const QString &backupFile);
+
+    /**
+     * Replaces the bookmarks with the ones in @p backupFile, one of
+     * availableBackups(), and saves them. The current version gets backed
+     * up first, so restoring can be undone.
+     * @return false if @p backupFile couldn't be read, or saving failed
+     * @since 5.50
+     */
+    bool restoreBackup(const QString &backupFile);
+
+    /**
+     * In lazy loading mode, the file is still read completely, but the
+     * bookmarks of a folder are only created when they are accessed for
+     * the first time, e.g. when showing its menu. This makes loading
+     * huge bookmark collections much faster when only the toolbar
+     * and a few menus get used.
+     *
+     * internalDocument(), saving, findByUrl() and KBookmark::internalElement()
+     * on a folder load everything they need first.
+     * Enable it before the bookmarks are loaded, e.g. before calling root().
+     * Disabling it loads all remaining folders.
+     * @since 5.50
+     */
+    void setLazyLoadingEnabled(bool enable);
+
+    /**
+     * @see setLazyLoadingEnabled
+     * @since 5.50
+     */
+    bool isLazyLoadingEnabled() const;
+
     void emitConfigChanged();
 
     /**
@@ -262,6 +545,9 @@ public:
 
     /**
      * @internal
+     * Same as KBookmark::internalElement(): changes made through the returned
+     * document have to be followed by emitChanged(), which drops the caches
+     * and makes the other processes reparse the file.
      */
     QDomDocument internalDocument() const;
 
@@ -325,15 +611,51 @@ Q_SIGNALS:
      */
     void error(const QString &errorMessage);
 
+    /**
+     * Emitted when saving changes delayed by setSaveDelay() finished.
+     * @param success false if the file couldn't be written, error() was emitted then
+     * @since 5.50
+     */
+    void saveFinished(bool success);
+
+    /**
+     * Signal send over D-Bus, before bookmarksChanged(), with the changes
+     * turning revision @p baseRevision of the file into @p revision.
+     * @internal
+     * @since 5.50
+     */
+    void bookmarksDelta(qulonglong baseRevision, qulonglong revision, const QByteArray &operations);
+
+    /**
+     * Signal send over D-Bus, after bookmarksChanged(), with the
+     * KBookmark::id() of the group too (empty for the root group).
+     * Other processes can use it to find the group even if the addresses
+     * changed since then.
+     * @since 5.50
+     */
+    void bookmarksChangedWithId(const QString &groupAddress, const QString &groupId);
+
 private Q_SLOTS:
     void slotFileChanged(const QString &path); // external bookmarks
+    // Applies the changes of another process, if this one is up to date with the one before
+    void notifyDelta(qulonglong baseRevision, qulonglong revision, const QByteArray &operations, const QDBusMessage &msg);
 
 private:
     // consts added to avoid a copy-and-paste of internalDocument
     void parse() const;
+    // Reloads the file, updating only what changed; returns the changed groups
+    QStringList reparse() const;
+    // internalDocument(), but folders loaded lazily may still be empty
+    QDomDocument shallowDocument() const;
     void init(const QString &dbusPath);
 
     void startKEditBookmarks(const QStringList &args);
+    void reportSaveError(const QString &filename, const QString &errorString) const;
+    bool storeChanges(const KBookmarkGroup &group);
+    bool saveAndBroadcast(const QString &groupAddress);
+    bool appendJournal(qulonglong baseRevision, const QByteArray &operations);
+    void startDelayedSave();
+    void finishDelayedSave(bool success, const QString &errorString);
 
     KBookmarkManagerPrivate *const d;
 
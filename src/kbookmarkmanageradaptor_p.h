@@ -40,6 +40,12 @@ Q_SIGNALS:
     void bookmarksChanged(const QString &groupAddress);
 
     void bookmarkConfigChanged();
+
+    // Sent before bookmarksChanged() when the changes are known, see KBookmarkOpLog
+    void bookmarksDelta(qulonglong baseRevision, qulonglong revision, const QByteArray &operations);
+
+    // After bookmarksChanged(), with the id of the group, see KBookmark::id()
+    void bookmarksChangedWithId(const QString &groupAddress, const QString &groupId);
 };
 
 #endif
@@ -0,0 +1,154 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkmigration_p.h"
+
+#include "kbookmarktree_p.h"
+
+// Same as in kbookmark.cpp
+#define METADATA_KDE_OWNER "http://www.kde.org"
+#define METADATA_FREEDESKTOP_OWNER "http://freedesktop.org"
+
+#define SCHEMA_VERSION_ATTRIBUTE "schemaVersion"
+
+// Increase when adding a migration below
+static const int s_currentVersion = 1;
+
+static int childElement(KBookmarkTree *tree, int parent, const QString &tagName)
+{
+    const int child = tree->firstChildElement(parent, tagName);
+    return child >= 0 ? child : tree->appendElement(parent, tagName);
+}
+
+// Same as findMetadata() in kbookmark.cpp
+static int metadata(KBookmarkTree *tree, int info, const QString &owner, bool create)
+{
+    const QString metadataTag = QStringLiteral("metadata");
+    const QString ownerAttribute = QStringLiteral("owner");
+    for (int elem = tree->firstChildElement(info, metadataTag); elem >= 0; elem = tree->nextSiblingElement(elem, metadataTag)) {
+        if (tree->attribute(elem, ownerAttribute) == owner) {
+            return elem;
+        }
+    }
+    if (!create) {
+        return -1;
+    }
+    const int elem = tree->appendElement(info, metadataTag);
+    tree->setAttribute(elem, ownerAttribute, owner);
+    return elem;
+}
+
+// Metadata without owner used to be taken over as KDE metadata on lookup
+static void claimMetadata(KBookmarkTree *tree, int info)
+{
+    const QString metadataTag = QStringLiteral("metadata");
+    const QString ownerAttribute = QStringLiteral("owner");
+    if (metadata(tree, info, QStringLiteral(METADATA_KDE_OWNER), false) >= 0) {
+        return;
+    }
+    int ownerless = -1;
+    for (int elem = tree->firstChildElement(info, metadataTag); elem >= 0; elem = tree->nextSiblingElement(elem, metadataTag)) {
+        if (tree->attribute(elem, ownerAttribute).isEmpty()) {
+            ownerless = elem;
+        }
+    }
+    if (ownerless >= 0) {
+        tree->setAttribute(ownerless, ownerAttribute, QStringLiteral(METADATA_KDE_OWNER));
+    }
+}
+
+static QString upgradedIconName(const QString &icon)
+{
+    if (icon == QLatin1String("www")) { // common icon for kde3 bookmarks
+        return QStringLiteral("internet-web-browser");
+    }
+    if (icon == QLatin1String("bookmark_folder")) {
+        return QStringLiteral("folder-bookmarks");
+    }
+    return icon;
+}
+
+static void upgradeBookmark(KBookmarkTree *tree, int elem)
+{
+    const QString infoTag = QStringLiteral("info");
+    int info = tree->firstChildElement(elem, infoTag);
+    if (info >= 0) {
+        claimMetadata(tree, info);
+    }
+
+    const QString showInToolbarAttribute = QStringLiteral("showintoolbar");
+    if (tree->hasAttribute(elem, showInToolbarAttribute)) {
+        const bool show = tree->attribute(elem, showInToolbarAttribute) == QLatin1String("yes");
+        tree->removeAttribute(elem, showInToolbarAttribute);
+        if (info < 0) {
+            info = tree->appendElement(elem, infoTag);
+        }
+        const int kdeMetadata = metadata(tree, info, QStringLiteral(METADATA_KDE_OWNER), true);
+        tree->setText(childElement(tree, kdeMetadata, showInToolbarAttribute), show ? QStringLiteral("yes") : QStringLiteral("no"));
+    }
+
+    const QString iconAttribute = QStringLiteral("icon");
+    const QString iconTag = QStringLiteral("bookmark:icon");
+    const QString nameAttribute = QStringLiteral("name");
+    const QString legacyIcon = tree->attribute(elem, iconAttribute);
+    tree->removeAttribute(elem, iconAttribute);
+    int iconElement = -1;
+    if (info >= 0) {
+        const int freedesktopMetadata = metadata(tree, info, QStringLiteral(METADATA_FREEDESKTOP_OWNER), false);
+        if (freedesktopMetadata >= 0) {
+            iconElement = tree->firstChildElement(freedesktopMetadata, iconTag);
+        }
+    }
+    if (iconElement >= 0 && !tree->attribute(iconElement, nameAttribute).isEmpty()) {
+        const QString icon = tree->attribute(iconElement, nameAttribute);
+        if (upgradedIconName(icon) != icon) {
+            tree->setAttribute(iconElement, nameAttribute, upgradedIconName(icon));
+        }
+    } else if (!legacyIcon.isEmpty()) {
+        if (iconElement < 0) {
+            if (info < 0) {
+                info = tree->appendElement(elem, infoTag);
+            }
+            iconElement = childElement(tree, metadata(tree, info, QStringLiteral(METADATA_FREEDESKTOP_OWNER), true), iconTag);
+        }
+        tree->setAttribute(iconElement, nameAttribute, upgradedIconName(legacyIcon));
+    }
+}
+
+bool KBookmarkMigration::upgrade(KBookmarkTree *tree)
+{
+    const int root = tree->documentElement();
+    if (root < 0) {
+        return false;
+    }
+    const QString versionAttribute = QStringLiteral(SCHEMA_VERSION_ATTRIBUTE);
+    if (tree->attribute(root, versionAttribute).toInt() >= s_currentVersion) {
+        return false;
+    }
+    // Upgrading appends nodes, which don't need to be looked at
+    for (int node = 0, count = tree->count(); node < count; ++node) {
+        const KBookmarkTree::BookmarkType type = tree->bookmarkType(node);
+        if (type == KBookmarkTree::FolderType || type == KBookmarkTree::UrlType) {
+            upgradeBookmark(tree, node);
+        }
+    }
+    tree->setAttribute(root, versionAttribute, QString::number(s_currentVersion));
+    return true;
+}
@@ -0,0 +1,46 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKMIGRATION_P_H
+#define KBOOKMARKMIGRATION_P_H
+
+class KBookmarkTree;
+
+/**
+ * Upgrades bookmark files written by older versions when they are loaded,
+ * so that the KBookmark getters only have to read the current format:
+ * - the "showintoolbar" and "icon" attributes become metadata
+ * - the kde3 icon names "www" and "bookmark_folder" are renamed
+ * - metadata without owner becomes KDE metadata
+ *
+ * The version of the format is stored in the \<xbel\> element, so that
+ * upgraded files aren't walked again.
+ * @internal
+ */
+class KBookmarkMigration
+{
+public:
+    /**
+     * @return true if @p tree was changed
+     */
+    static bool upgrade(KBookmarkTree *tree);
+};
+
+#endif
@@ -0,0 +1,467 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkoplog_p.h"
+
+#include "kbookmark.h"
+#include "kbookmarkaddress_p.h"
+#include "kbookmarkindex_p.h"
+
+#include <QDataStream>
+#include <QPair>
+
+namespace
+{
+enum NodeKind {
+    ElementNode = 1,
+    TextNode,
+    CommentNode
+};
+}
+
+static const quint8 s_formatVersion = 1;
+// Bookmark files aren't nested that deep, this only protects against bogus data
+static const int s_maxDepth = 256;
+
+static bool isBookmarkTag(const QDomNode &node)
+{
+    const QString tag = node.toElement().tagName();
+    return tag == QLatin1String("folder") || tag == QLatin1String("bookmark")
+           || tag == QLatin1String("separator");
+}
+
+static void writeAttributes(QDataStream &stream, const QDomElement &element)
+{
+    const QDomNamedNodeMap attributes = element.attributes();
+    stream << quint32(attributes.count());
+    for (int i = 0; i < attributes.count(); ++i) {
+        const QDomAttr attribute = attributes.item(i).toAttr();
+        stream << attribute.name() << attribute.value();
+    }
+}
+
+static void writeNode(QDataStream &stream, const QDomNode &node);
+
+// Processing instructions and the like aren't part of bookmark files
+static void writeChildren(QDataStream &stream, const QDomElement &element, bool skipBookmarks)
+{
+    QVector<QDomNode> children;
+    for (QDomNode child = element.firstChild(); !child.isNull(); child = child.nextSibling()) {
+        if ((child.isElement() && !(skipBookmarks && isBookmarkTag(child))) || child.isText() || child.isComment()) {
+            children.append(child);
+        }
+    }
+    stream << quint32(children.count());
+    for (int i = 0; i < children.count(); ++i) {
+        writeNode(stream, children.at(i));
+    }
+}
+
+static void writeNode(QDataStream &stream, const QDomNode &node)
+{
+    if (node.isElement()) {
+        const QDomElement element = node.toElement();
+        stream << quint8(ElementNode) << element.tagName();
+        writeAttributes(stream, element);
+        writeChildren(stream, element, false);
+    } else if (node.isText()) { // CDATA sections too
+        stream << quint8(TextNode) << node.nodeValue();
+    } else {
+        stream << quint8(CommentNode) << node.nodeValue();
+    }
+}
+
+static bool readAttributes(QDataStream &stream, QVector<QPair<QString, QString> > *attributes)
+{
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString name;
+        QString value;
+        stream >> name >> value;
+        attributes->append(qMakePair(name, value));
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+static bool readChildren(QDataStream &stream, QDomDocument &doc, QDomElement &parent, const QDomNode &before, int depth);
+
+static QDomNode readNode(QDataStream &stream, QDomDocument &doc, int depth)
+{
+    quint8 kind;
+    QString value;
+    stream >> kind >> value;
+    if (stream.status() != QDataStream::Ok) {
+        return QDomNode();
+    }
+    switch (kind) {
+    case ElementNode: {
+        QVector<QPair<QString, QString> > attributes;
+        if (value.isEmpty() || !readAttributes(stream, &attributes)) {
+            return QDomNode();
+        }
+        QDomElement element = doc.createElement(value);
+        for (int i = 0; i < attributes.count(); ++i) {
+            element.setAttribute(attributes.at(i).first, attributes.at(i).second);
+        }
+        if (!readChildren(stream, doc, element, QDomNode(), depth + 1)) {
+            return QDomNode();
+        }
+        return element;
+    }
+    case TextNode:
+        return doc.createTextNode(value);
+    case CommentNode:
+        return doc.createComment(value);
+    }
+    return QDomNode();
+}
+
+static bool readChildren(QDataStream &stream, QDomDocument &doc, QDomElement &parent, const QDomNode &before, int depth)
+{
+    if (depth > s_maxDepth) {
+        return false;
+    }
+    quint32 count;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        const QDomNode child = readNode(stream, doc, depth);
+        if (child.isNull()) {
+            return false;
+        }
+        if (before.isNull()) {
+            parent.appendChild(child);
+        } else {
+            parent.insertBefore(child, before);
+        }
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+// The part of element which isn't a child bookmark: attributes, title, metadata...
+static QByteArray serializeShallow(const QDomElement &element)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    writeAttributes(stream, element);
+    writeChildren(stream, element, true);
+    return data;
+}
+
+static bool applyShallow(const QByteArray &data, QDomDocument &doc, QDomElement &element)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    QVector<QPair<QString, QString> > attributes;
+    if (!readAttributes(stream, &attributes)) {
+        return false;
+    }
+    const QDomNamedNodeMap oldAttributes = element.attributes();
+    for (int i = oldAttributes.count() - 1; i >= 0; --i) {
+        element.removeAttribute(oldAttributes.item(i).nodeName());
+    }
+    for (int i = 0; i < attributes.count(); ++i) {
+        element.setAttribute(attributes.at(i).first, attributes.at(i).second);
+    }
+
+    QDomNode firstBookmark;
+    for (QDomNode child = element.firstChild(); !child.isNull();) {
+        const QDomNode next = child.nextSibling();
+        if (!isBookmarkTag(child)) {
+            element.removeChild(child);
+        } else if (firstBookmark.isNull()) {
+            firstBookmark = child;
+        }
+        child = next;
+    }
+    return readChildren(stream, doc, element, firstBookmark, 0);
+}
+
+static QDomElement resolve(const QDomDocument &doc, KBookmarkIndex *index, const QString &address)
+{
+    const KBookmarkAddress parsed = KBookmarkAddress::fromString(address);
+    QDomElement element = doc.documentElement();
+    for (int level = 0; level < parsed.depth() && !element.isNull(); ++level) {
+        element = index->child(element, parsed.at(level));
+    }
+    return element;
+}
+
+// Inserts element where the address says, the same way KBookmarkGroup does
+static bool insertAt(const QDomDocument &doc, KBookmarkIndex *index, const QString &address, const QDomElement &element, QDomElement *parent)
+{
+    *parent = resolve(doc, index, KBookmark::parentAddress(address));
+    const QString tag = parent->tagName();
+    if (tag != QLatin1String("xbel") && tag != QLatin1String("folder")) {
+        return false;
+    }
+    const int position = KBookmark::positionInParent(address);
+    const QDomElement before = index->child(*parent, position);
+    if (!before.isNull()) {
+        parent->insertBefore(element, before);
+    } else if (position == 0 || !index->child(*parent, position - 1).isNull()) {
+        parent->appendChild(element);
+    } else {
+        return false;
+    }
+    index->invalidateGroup(*parent);
+    return true;
+}
+
+KBookmarkOpLog::KBookmarkOpLog()
+    : m_enabled(false)
+    , m_tainted(false)
+{
+}
+
+void KBookmarkOpLog::setEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    clear();
+}
+
+bool KBookmarkOpLog::isEnabled() const
+{
+    return m_enabled;
+}
+
+bool KBookmarkOpLog::hasOperations() const
+{
+    return !m_ops.isEmpty();
+}
+
+bool KBookmarkOpLog::isTainted() const
+{
+    return m_tainted;
+}
+
+void KBookmarkOpLog::setTainted()
+{
+    if (m_enabled) {
+        m_tainted = true;
+        m_ops.clear();
+    }
+}
+
+void KBookmarkOpLog::clear()
+{
+    m_ops.clear();
+    m_tainted = false;
+}
+
+void KBookmarkOpLog::recordInsert(const QDomElement &element)
+{
+    if (!m_enabled || m_tainted || !isInDocument(element)) {
+        return;
+    }
+    Op op;
+    op.type = InsertOp;
+    op.address = KBookmark(element).address();
+    QDataStream stream(&op.subtree, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    writeNode(stream, element);
+    m_ops.append(op);
+}
+
+void KBookmarkOpLog::recordMove(const QString &fromAddress, const QDomElement &element)
+{
+    if (!m_enabled || m_tainted || !isInDocument(element)) {
+        return;
+    }
+    Op op;
+    op.type = MoveOp;
+    op.address = KBookmark(element).address();
+    op.fromAddress = fromAddress;
+    m_ops.append(op);
+}
+
+void KBookmarkOpLog::recordDelete(const QString &address)
+{
+    if (!m_enabled || m_tainted) {
+        return;
+    }
+    Op op;
+    op.type = DeleteOp;
+    op.address = address;
+    m_ops.append(op);
+}
+
+void KBookmarkOpLog::recordUpdate(const QDomElement &element)
+{
+    if (!m_enabled || m_tainted || !isInDocument(element)) {
+        return;
+    }
+    const QString address = KBookmark(element).address();
+    if (!m_ops.isEmpty() && m_ops.last().type == UpdateOp && m_ops.last().address == address) {
+        return; // e.g. the metadata items set by KBookmark::updateAccessMetadata()
+    }
+    Op op;
+    op.type = UpdateOp;
+    op.address = address;
+    op.element = element;
+    m_ops.append(op);
+}
+
+QByteArray KBookmarkOpLog::serialize() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_6);
+    stream << s_formatVersion << quint32(m_ops.count());
+    for (int i = 0; i < m_ops.count(); ++i) {
+        const Op &op = m_ops.at(i);
+        stream << quint8(op.type) << op.address;
+        switch (op.type) {
+        case InsertOp:
+            stream << op.subtree;
+            break;
+        case MoveOp:
+            stream << op.fromAddress;
+            break;
+        case DeleteOp:
+            break;
+        case UpdateOp:
+            // The final state is enough, even if the element changed again after a later operation
+            stream << serializeShallow(op.element);
+            break;
+        }
+    }
+    return data;
+}
+
+bool KBookmarkOpLog::apply(const QByteArray &data, const QDomDocument &doc, KBookmarkIndex *index, QStringList *changedGroups)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    quint8 version;
+    quint32 count;
+    stream >> version >> count;
+    if (stream.status() != QDataStream::Ok || version != s_formatVersion) {
+        return false;
+    }
+
+    QDomDocument document = doc;
+    const QDomElement root = document.documentElement();
+    QVector<QDomElement> changed;
+    for (quint32 i = 0; i < count; ++i) {
+        quint8 type;
+        QString address;
+        stream >> type >> address;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        switch (type) {
+        case InsertOp: {
+            QByteArray subtree;
+            stream >> subtree;
+            QDataStream subtreeStream(subtree);
+            subtreeStream.setVersion(QDataStream::Qt_5_6);
+            const QDomElement element = readNode(subtreeStream, document, 0).toElement();
+            QDomElement parent;
+            if (element.isNull() || !insertAt(document, index, address, element, &parent)) {
+                return false;
+            }
+            index->bookmarksAdded(element);
+            changed.append(parent);
+            break;
+        }
+        case MoveOp: {
+            QString fromAddress;
+            stream >> fromAddress;
+            const QDomElement element = resolve(document, index, fromAddress);
+            if (element.isNull() || element == root) {
+                return false;
+            }
+            QDomElement oldParent = element.parentNode().toElement();
+            oldParent.removeChild(element);
+            index->invalidateGroup(oldParent);
+            changed.append(oldParent);
+            QDomElement parent;
+            if (!insertAt(document, index, address, element, &parent)) {
+                return false;
+            }
+            changed.append(parent);
+            break;
+        }
+        case DeleteOp: {
+            const QDomElement element = resolve(document, index, address);
+            if (element.isNull() || element == root) {
+                return false;
+            }
+            QDomElement parent = element.parentNode().toElement();
+            parent.removeChild(element);
+            index->invalidateGroup(parent);
+            index->bookmarksRemoved(element);
+            changed.append(parent);
+            break;
+        }
+        case UpdateOp: {
+            QByteArray shallow;
+            stream >> shallow;
+            QDomElement element = resolve(document, index, address);
+            if (element.isNull()) {
+                return false;
+            }
+            const QString oldHref = element.attribute(QStringLiteral("href"));
+            const QString oldId = element.attribute(QStringLiteral("id"));
+            if (!applyShallow(shallow, document, element)) {
+                return false;
+            }
+            index->fieldsChanged(element);
+            if (element.attribute(QStringLiteral("id")) != oldId) {
+                index->idAssigned(element);
+            }
+            if (element.tagName() == QLatin1String("bookmark")) {
+                index->urlChanged(element, oldHref);
+            }
+            // The title and icon are shown in the listing of the parent
+            changed.append(element == root ? root : element.parentNode().toElement());
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    if (stream.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    // Addresses of the final document
+    for (int i = 0; i < changed.count(); ++i) {
+        const QDomElement &group = changed.at(i);
+        if (isInDocument(group)) {
+            const QString address = KBookmark(group).address();
+            if (!changedGroups->contains(address)) {
+                changedGroups->append(address);
+            }
+        }
+    }
+    return true;
+}
+
+bool KBookmarkOpLog::isInDocument(const QDomElement &element)
+{
+    QDomNode node = element;
+    while (!node.isNull() && !node.isDocument()) {
+        node = node.parentNode();
+    }
+    return !node.isNull();
+}
@@ -0,0 +1,117 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKOPLOG_P_H
+#define KBOOKMARKOPLOG_P_H
+
+#include <QByteArray>
+#include <QDomElement>
+#include <QStringList>
+#include <QVector>
+
+class KBookmarkIndex;
+
+/**
+ * The changes done to a document through the KBookmark API since it was
+ * last broadcast, so that other processes sharing the bookmark file can
+ * replay them instead of parsing the whole file again.
+ *
+ * Every operation refers to bookmarks by address, as they were at the time
+ * of the operation, so the operations have to be replayed in order on a
+ * document identical to the one they were recorded on.
+ *
+ * Direct DOM changes (KBookmark::internalElement(),
+ * KBookmarkManager::internalDocument()) can't be recorded and taint the log
+ * when emitChanged() reports them: its changes then have to be read from the file.
+ * @internal
+ */
+class KBookmarkOpLog
+{
+public:
+    KBookmarkOpLog();
+
+    /**
+     * Only the logs of documents shared over D-Bus record anything
+     */
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    /**
+     * @return whether operations were recorded since the last clear()
+     */
+    bool hasOperations() const;
+    bool isTainted() const;
+    void setTainted();
+    void clear();
+
+    /**
+     * @p element, a bookmark, folder or separator, was inserted with its children
+     */
+    void recordInsert(const QDomElement &element);
+    /**
+     * @p element was moved from @p fromAddress within the same document
+     */
+    void recordMove(const QString &fromAddress, const QDomElement &element);
+    /**
+     * The element at @p address is about to be removed
+     */
+    void recordDelete(const QString &address);
+    /**
+     * The attributes, title or metadata of @p element changed
+     */
+    void recordUpdate(const QDomElement &element);
+
+    /**
+     * @return the operations, in the format read by apply()
+     */
+    QByteArray serialize() const;
+    /**
+     * Replays the operations in @p data on @p doc.
+     * @param changedGroups gets the addresses of the groups whose listing changed
+     * @return false if the operations don't match @p doc, which is then
+     * partially modified and has to be reloaded
+     */
+    static bool apply(const QByteArray &data, const QDomDocument &doc, KBookmarkIndex *index, QStringList *changedGroups);
+
+    /**
+     * @return whether @p element is part of its owner document
+     */
+    static bool isInDocument(const QDomElement &element);
+
+private:
+    enum OpType {
+        InsertOp = 1,
+        MoveOp,
+        DeleteOp,
+        UpdateOp
+    };
+    struct Op {
+        OpType type;
+        QString address;
+        QString fromAddress; // MoveOp
+        QByteArray subtree;  // InsertOp, serialized when recorded
+        QDomElement element; // UpdateOp, serialized when broadcast
+    };
+    QVector<Op> m_ops;
+    bool m_enabled;
+    bool m_tainted;
+};
+
+#endif
@@ -0,0 +1,162 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarksaver_p.h"
+#include "kbookmark.h"
+#include "kbookmarkbinarycache_p.h"
+#include "kbookmarkjournal_p.h"
+#include "kbookmarkxbelwriter_p.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+
+bool kbookmarkWriteFile(const QString &filename, const QDomDocument &doc, bool toolbarCache,
+                        const KBookmarkBackup::Policy &backupPolicy, QString *errorString, QByteArray *hash)
+{
+    const KBookmarkGroup root(doc.documentElement());
+
+    // Save the bookmark toolbar folder for quick loading
+    // but only when it will actually make things quicker
+    const QString cacheFilename = filename + QLatin1String(".tbcache");
+    if (toolbarCache && !root.isToolbarGroup()) {
+        QSaveFile cacheFile(cacheFilename);
+        if (cacheFile.open(QIODevice::WriteOnly)) {
+            KBookmarkXbelWriter writer(&cacheFile);
+            writer.writeElement(root.findToolbar());
+            if (writer.finish()) {
+                cacheFile.commit();
+            }
+        }
+    } else { // remove any (now) stale cache
+        QFile::remove(cacheFilename);
+    }
+
+    // Create parent dirs
+    QFileInfo info(filename);
+    QDir().mkpath(info.absolutePath());
+
+    QSaveFile file(filename);
+    if (file.open(QIODevice::WriteOnly)) {
+        // Streamed in chunks, the document is never held as a whole string
+        KBookmarkXbelWriter writer(&file);
+        // Next time, load this from the binary cache instead of parsing it
+        KBookmarkTree tree;
+        writer.setTree(&tree);
+        writer.writeDocument(doc);
+        bool written = writer.finish();
+        if (written) {
+            // Only once the new version is complete, right before it replaces the old one
+            KBookmarkBackup::backup(file.fileName(), backupPolicy);
+            written = file.commit();
+        }
+        if (written) {
+            KBookmarkBinaryCache::write(filename, writer.hash(), tree);
+            // The journal holds changes to the previous version, which are in the file now
+            if (QFile::exists(KBookmarkJournal::fileName(filename))) {
+                KBookmarkJournal::reset(filename, writer.hash());
+            }
+            if (hash) {
+                *hash = writer.hash();
+            }
+            return true;
+        }
+    }
+    *errorString = file.errorString();
+    return false;
+}
+
+class KBookmarkSaveJob : public QRunnable
+{
+public:
+    KBookmarkSaveJob(KBookmarkSaver *saver, const QString &filename, const QDomDocument &doc,
+                     const KBookmarkBackup::Policy &backupPolicy)
+        : m_saver(saver)
+        , m_filename(filename)
+        , m_doc(doc)
+        , m_backupPolicy(backupPolicy)
+    {
+    }
+
+    void run() override
+    {
+        QString errorString;
+        const bool success = kbookmarkWriteFile(m_filename, m_doc, true, m_backupPolicy, &errorString);
+        m_doc.clear();
+        m_saver->setResult(success, errorString);
+    }
+
+private:
+    KBookmarkSaver *m_saver;
+    QString m_filename;
+    QDomDocument m_doc;
+    KBookmarkBackup::Policy m_backupPolicy;
+};
+
+KBookmarkSaver::KBookmarkSaver(QObject *parent)
+    : QObject(parent)
+    , m_running(false)
+    , m_success(true)
+{
+    m_pool.setMaxThreadCount(1);
+}
+
+KBookmarkSaver::~KBookmarkSaver()
+{
+    m_pool.waitForDone();
+}
+
+void KBookmarkSaver::start(const QString &filename, const QDomDocument &doc, const KBookmarkBackup::Policy &backupPolicy)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_running = true;
+    }
+    m_pool.start(new KBookmarkSaveJob(this, filename, doc, backupPolicy));
+}
+
+bool KBookmarkSaver::isRunning() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_running;
+}
+
+bool KBookmarkSaver::waitForFinished(QString *errorString)
+{
+    m_pool.waitForDone();
+    QMutexLocker locker(&m_mutex);
+    if (errorString) {
+        *errorString = m_errorString;
+    }
+    return m_success;
+}
+
+void KBookmarkSaver::setResult(bool success, const QString &errorString)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_running = false;
+        m_success = success;
+        m_errorString = errorString;
+    }
+    emit finished(success, errorString);
+}
+
+#include "moc_kbookmarksaver_p.cpp"
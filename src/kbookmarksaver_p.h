@@ -0,0 +1,82 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKSAVER_P_H
+#define KBOOKMARKSAVER_P_H
+
+#include "kbookmarkbackup_p.h"
+
+#include <QDomDocument>
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+
+/**
+ * Writes @p doc to @p filename, with a backup of the previous version as
+ * asked by @p backupPolicy, and the toolbar cache if @p toolbarCache is true.
+ * Only touches @p doc, so it can run in any thread as long as nobody else uses @p doc.
+ * A journal of the previous version is started over, see KBookmarkJournal.
+ * @param hash if not null, gets the SHA-1 of what was written
+ * @return true on success, otherwise @p errorString tells what went wrong
+ */
+bool kbookmarkWriteFile(const QString &filename, const QDomDocument &doc, bool toolbarCache,
+                        const KBookmarkBackup::Policy &backupPolicy, QString *errorString, QByteArray *hash = nullptr);
+
+/**
+ * Writes bookmark files in a worker thread, one at a time.
+ * @internal
+ */
+class KBookmarkSaver : public QObject
+{
+    Q_OBJECT
+public:
+    explicit KBookmarkSaver(QObject *parent = nullptr);
+    ~KBookmarkSaver() override;
+
+    /**
+     * Starts writing @p doc to @p filename.
+     * @p doc must be a deep copy which isn't used anywhere else,
+     * QDom isn't thread-safe.
+     */
+    void start(const QString &filename, const QDomDocument &doc, const KBookmarkBackup::Policy &backupPolicy);
+    bool isRunning() const;
+    /**
+     * Blocks until the current write is done.
+     * @return its result, finished() is emitted nonetheless
+     */
+    bool waitForFinished(QString *errorString = nullptr);
+
+Q_SIGNALS:
+    /**
+     * Emitted from the worker thread
+     */
+    void finished(bool success, const QString &errorString);
+
+private:
+    friend class KBookmarkSaveJob;
+    void setResult(bool success, const QString &errorString);
+
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;
+    bool m_running;
+    bool m_success;
+    QString m_errorString;
+};
+
+#endif
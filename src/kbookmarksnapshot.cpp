@@ -0,0 +1,294 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarksnapshot.h"
+#include "kbookmarksnapshot_p.h"
+#include "kbookmarkindex_p.h"
+
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+// The index keeps the nodes of unchanged bookmarks and folders,
+// so that only the changed ones and their parents are created again
+static KBookmarkSnapshotNode::Ptr createNode(const KBookmark &bookmark, KBookmarkIndex *index)
+{
+    const QDomElement element = kbookmarkElement(bookmark);
+    KBookmarkSnapshotNode::Ptr cached;
+    if (index && index->cachedSnapshotNode(element, &cached)) {
+        return cached;
+    }
+
+    KBookmarkSnapshotNode *node = new KBookmarkSnapshotNode;
+    const KBookmarkSnapshotNode::Ptr result(node);
+    node->size = 1;
+    if (bookmark.isGroup()) {
+        node->type = KBookmarkSnapshot::Folder;
+        const KBookmarkGroup group = bookmark.toGroup();
+        for (const KBookmark &child : group.children()) {
+            const KBookmarkSnapshotNode::Ptr childNode = createNode(child, index);
+            node->size += childNode->size;
+            node->children.append(childNode);
+        }
+    } else if (bookmark.isSeparator()) {
+        node->type = KBookmarkSnapshot::Separator;
+    } else {
+        node->type = KBookmarkSnapshot::Bookmark;
+        node->url = bookmark.url();
+    }
+    if (node->type != KBookmarkSnapshot::Separator) {
+        node->text = bookmark.fullText();
+    }
+    node->id = element.attribute(QStringLiteral("id"));
+    if (index) {
+        index->insertSnapshotNode(element, result);
+    }
+    return result;
+}
+
+KBookmarkSnapshotNode::Ptr KBookmarkSnapshotNode::fromTree(const KBookmarkTree &tree, int element)
+{
+    KBookmarkSnapshotNode *node = new KBookmarkSnapshotNode;
+    const Ptr result(node);
+    node->size = 1;
+    switch (tree.bookmarkType(element)) {
+    case KBookmarkTree::RootType:
+    case KBookmarkTree::FolderType:
+        node->type = KBookmarkSnapshot::Folder;
+        for (int child = tree.firstBookmark(element); child >= 0; child = tree.nextBookmark(child)) {
+            const Ptr childNode = fromTree(tree, child);
+            node->size += childNode->size;
+            node->children.append(childNode);
+        }
+        break;
+    case KBookmarkTree::SeparatorType:
+        node->type = KBookmarkSnapshot::Separator;
+        break;
+    default:
+        node->type = KBookmarkSnapshot::Bookmark;
+        node->url = QUrl(tree.attribute(element, QStringLiteral("href")));
+        break;
+    }
+    if (node->type != KBookmarkSnapshot::Separator) {
+        node->text = tree.fullText(element);
+    }
+    node->id = tree.attribute(element, QStringLiteral("id"));
+    return result;
+}
+
+KBookmarkSnapshot::KBookmarkSnapshot()
+{
+}
+
+KBookmarkSnapshot::KBookmarkSnapshot(const KBookmarkGroup &group)
+{
+    if (!group.isNull()) {
+        d = createNode(group, KBookmarkIndex::forNode(kbookmarkElement(group)));
+    }
+}
+
+KBookmarkSnapshot::KBookmarkSnapshot(const KBookmarkSnapshotNode *node)
+    : d(node)
+{
+}
+
+KBookmarkSnapshot::KBookmarkSnapshot(const KBookmarkSnapshot &other)
+    : d(other.d)
+{
+}
+
+KBookmarkSnapshot &KBookmarkSnapshot::operator=(const KBookmarkSnapshot &other)
+{
+    d = other.d;
+    return *this;
+}
+
+KBookmarkSnapshot::~KBookmarkSnapshot()
+{
+}
+
+bool KBookmarkSnapshot::isNull() const
+{
+    return !d;
+}
+
+KBookmarkSnapshot::Type KBookmarkSnapshot::type() const
+{
+    return d ? d->type : Separator;
+}
+
+QString KBookmarkSnapshot::text() const
+{
+    return d ? d->text : QString();
+}
+
+QUrl KBookmarkSnapshot::url() const
+{
+    return d ? d->url : QUrl();
+}
+
+QString KBookmarkSnapshot::id() const
+{
+    return d ? d->id : QString();
+}
+
+int KBookmarkSnapshot::childCount() const
+{
+    return d ? d->children.count() : 0;
+}
+
+KBookmarkSnapshot KBookmarkSnapshot::child(int position) const
+{
+    if (!d || position < 0 || position >= d->children.count()) {
+        return KBookmarkSnapshot();
+    }
+    return KBookmarkSnapshot(d->children.at(position).data());
+}
+
+int KBookmarkSnapshot::descendantCount() const
+{
+    return d ? d->size - 1 : 0;
+}
+
+bool KBookmarkSnapshot::isSharedWith(const KBookmarkSnapshot &other) const
+{
+    return d && d == other.d;
+}
+
+namespace
+{
+// A node, alone or with everything below it
+struct Piece {
+    const KBookmarkSnapshotNode *node;
+    bool withDescendants;
+    int size;
+};
+
+// Whole subtrees where they are small enough, so that the pieces are about as big as target
+void split(const KBookmarkSnapshotNode *node, int target, QVector<Piece> *pieces)
+{
+    if (node->size <= target) {
+        const Piece piece = { node, true, node->size };
+        pieces->append(piece);
+        return;
+    }
+    const Piece piece = { node, false, 1 };
+    pieces->append(piece);
+    for (int i = 0; i < node->children.count(); ++i) {
+        split(node->children.at(i).data(), target, pieces);
+    }
+}
+
+class ParallelVisit
+{
+public:
+    QVector<Piece> pieces;
+    QVector<int> chunkStarts; // in pieces
+    QAtomicInt nextChunk;
+    QSemaphore finishedChunks;
+
+    // Takes the chunks nobody took yet, until there are none left
+    void run(const std::function<void(const KBookmarkSnapshotNode *, int)> &visitSubtree)
+    {
+        for (int chunk = nextChunk.fetchAndAddRelaxed(1); chunk < chunkStarts.count(); chunk = nextChunk.fetchAndAddRelaxed(1)) {
+            const int end = chunk + 1 < chunkStarts.count() ? chunkStarts.at(chunk + 1) : pieces.count();
+            for (int i = chunkStarts.at(chunk); i < end; ++i) {
+                visitSubtree(pieces.at(i).node, pieces.at(i).withDescendants ? chunk : -chunk - 1);
+            }
+            finishedChunks.release();
+        }
+    }
+};
+
+class KBookmarkSnapshotTask : public QRunnable
+{
+public:
+    explicit KBookmarkSnapshotTask(const QSharedPointer<ParallelVisit> &work,
+                                   const std::function<void(const KBookmarkSnapshotNode *, int)> &visitSubtree)
+        : m_work(work)
+        , m_visitSubtree(visitSubtree)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        m_work->run(m_visitSubtree);
+    }
+
+private:
+    // Shared, as the task may only start when the caller is done already
+    QSharedPointer<ParallelVisit> m_work;
+    std::function<void(const KBookmarkSnapshotNode *, int)> m_visitSubtree;
+};
+}
+
+void KBookmarkSnapshot::visitParallel(const std::function<void(int)> &prepare,
+                                      const std::function<void(int, const KBookmarkSnapshot &)> &visit,
+                                      QThreadPool *pool) const
+{
+    if (!d || d->children.isEmpty()) {
+        prepare(0);
+        return;
+    }
+    if (!pool) {
+        pool = QThreadPool::globalInstance();
+    }
+
+    // A few chunks per thread, so that threads finishing early can take more
+    const int threadCount = qMax(1, pool->maxThreadCount());
+    const int target = qMax(64, descendantCount() / (threadCount * 4) + 1);
+    QSharedPointer<ParallelVisit> work(new ParallelVisit);
+    for (int i = 0; i < d->children.count(); ++i) {
+        split(d->children.at(i).data(), target, &work->pieces);
+    }
+    int chunkSize = 0;
+    for (int i = 0; i < work->pieces.count(); ++i) {
+        if (chunkSize == 0) {
+            work->chunkStarts.append(i);
+        }
+        chunkSize += work->pieces.at(i).size;
+        if (chunkSize >= target) {
+            chunkSize = 0;
+        }
+    }
+    const int chunkCount = work->chunkStarts.count();
+    prepare(chunkCount);
+
+    // chunk is -chunk - 1 for a node without its descendants
+    std::function<void(const KBookmarkSnapshotNode *, int)> visitSubtree;
+    visitSubtree = [&visit, &visitSubtree](const KBookmarkSnapshotNode *node, int chunk) {
+        if (chunk < 0) {
+            visit(-chunk - 1, KBookmarkSnapshot(node));
+            return;
+        }
+        visit(chunk, KBookmarkSnapshot(node));
+        for (int i = 0; i < node->children.count(); ++i) {
+            visitSubtree(node->children.at(i).data(), chunk);
+        }
+    };
+
+    for (int i = 1; i < qMin(threadCount, chunkCount); ++i) {
+        pool->start(new KBookmarkSnapshotTask(work, visitSubtree));
+    }
+    work->run(visitSubtree);
+    work->finishedChunks.acquire(chunkCount);
+}
@@ -0,0 +1,148 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef __kbookmarksnapshot_h
+#define __kbookmarksnapshot_h
+
+#include "kbookmark.h"
+
+#include <QExplicitlySharedDataPointer>
+#include <QString>
+#include <QUrl>
+#include <QVector>
+
+#include <functional>
+
+class QThreadPool;
+class KBookmarkSnapshotNode;
+
+/**
+ * A read-only copy of a bookmark folder and everything below it.
+ *
+ * Unlike KBookmark, which wraps the DOM of the KBookmarkManager, a snapshot
+ * doesn't change when the bookmarks are edited, and can be read from any
+ * number of threads at the same time. Copying it is cheap, the nodes are
+ * shared.
+ *
+ * mapReduce() processes a big tree in several threads:
+ * \code
+ * const KBookmarkSnapshot snapshot(manager->root());
+ * const int count = snapshot.mapReduce<int>(
+ *     [](const KBookmarkSnapshot &node) { return node.type() == KBookmarkSnapshot::Bookmark ? 1 : 0; },
+ *     [](int a, int b) { return a + b; });
+ * \endcode
+ * @since 5.50
+ */
+class KBOOKMARKS_EXPORT KBookmarkSnapshot
+{
+public:
+    enum Type {
+        Folder,
+        Bookmark,
+        Separator
+    };
+
+    /**
+     * Creates a null snapshot
+     */
+    KBookmarkSnapshot();
+    /**
+     * Copies @p group and everything below it.
+     *
+     * The bookmarks of a KBookmarkManager share the parts which didn't
+     * change with the snapshots taken before, see KBookmarkManager::snapshot().
+     */
+    explicit KBookmarkSnapshot(const KBookmarkGroup &group);
+    KBookmarkSnapshot(const KBookmarkSnapshot &other);
+    KBookmarkSnapshot &operator=(const KBookmarkSnapshot &other);
+    ~KBookmarkSnapshot();
+
+    bool isNull() const;
+    Type type() const;
+    /**
+     * @see KBookmark::fullText()
+     */
+    QString text() const;
+    QUrl url() const;
+    /**
+     * The KBookmark::id() of the bookmark, if it had one already
+     */
+    QString id() const;
+
+    int childCount() const;
+    KBookmarkSnapshot child(int position) const;
+    /**
+     * @return the number of folders, bookmarks and separators below this one
+     */
+    int descendantCount() const;
+
+    /**
+     * @return true if this and @p other are the same node, e.g. a folder
+     * which didn't change between two KBookmarkManager::snapshot() calls
+     */
+    bool isSharedWith(const KBookmarkSnapshot &other) const;
+
+    /**
+     * Calls @p map for each folder, bookmark and separator below this one,
+     * and combines the results with @p reduce.
+     *
+     * The tree is split into chunks of consecutive nodes (in the order of
+     * KBookmarkGroup::descendants()), which idle threads of @p pool (the
+     * global one by default) and the calling thread take one after the
+     * other. The results of the chunks are then combined in order, so the
+     * result is the same as when visiting all nodes one by one, as long as
+     * @p reduce is associative and @p initial is neutral to it.
+     *
+     * @p map and @p reduce are called from several threads at the same time.
+     * @param map returns a T for a KBookmarkSnapshot
+     * @param reduce returns the combination of two T
+     */
+    template<typename T, typename MapFunctor, typename ReduceFunctor>
+    T mapReduce(MapFunctor map, ReduceFunctor reduce, const T &initial = T(), QThreadPool *pool = nullptr) const
+    {
+        QVector<T> partial;
+        T *partialData = nullptr;
+        visitParallel([&](int chunkCount) {
+            partial.fill(initial, chunkCount);
+            partialData = partial.data();
+        }, [&](int chunk, const KBookmarkSnapshot &node) {
+            T &result = partialData[chunk];
+            result = reduce(result, map(node));
+        }, pool);
+        T result = initial;
+        for (int i = 0; i < partial.count(); ++i) {
+            result = reduce(result, partial.at(i));
+        }
+        return result;
+    }
+
+private:
+    friend class KBookmarkManager;
+    explicit KBookmarkSnapshot(const KBookmarkSnapshotNode *node);
+    // Splits the nodes below this one into chunks, calls prepare() with
+    // their number, then visit() for each node, from several threads
+    void visitParallel(const std::function<void(int)> &prepare,
+                       const std::function<void(int, const KBookmarkSnapshot &)> &visit,
+                       QThreadPool *pool) const;
+
+    QExplicitlySharedDataPointer<const KBookmarkSnapshotNode> d;
+};
+
+#endif
@@ -0,0 +1,53 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKSNAPSHOT_P_H
+#define KBOOKMARKSNAPSHOT_P_H
+
+#include "kbookmarksnapshot.h"
+#include "kbookmarktree_p.h"
+
+#include <QSharedData>
+
+/**
+ * A node of a KBookmarkSnapshot. Never changed once created, so that
+ * snapshots can share it with the ones taken before and after.
+ * @internal
+ */
+class KBookmarkSnapshotNode : public QSharedData
+{
+public:
+    typedef QExplicitlySharedDataPointer<const KBookmarkSnapshotNode> Ptr;
+
+    KBookmarkSnapshot::Type type;
+    QString text;
+    QUrl url;
+    QString id;
+    QVector<Ptr> children;
+    int size; // this node and all below it
+
+    /**
+     * Same as a snapshot of the DOM materialized from @p tree, for
+     * @p element and everything below it
+     */
+    static Ptr fromTree(const KBookmarkTree &tree, int element);
+};
+
+#endif
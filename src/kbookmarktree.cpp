@@ -0,0 +1,499 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarktree_p.h"
+
+#include <QDomNamedNodeMap>
+
+KBookmarkStringPool::KBookmarkStringPool()
+{
+    clear();
+}
+
+int KBookmarkStringPool::intern(const QString &string)
+{
+    if (string.isEmpty()) {
+        return 0;
+    }
+    QHash<QString, int>::const_iterator it = m_ids.constFind(string);
+    if (it != m_ids.constEnd()) {
+        return it.value();
+    }
+    const int id = m_strings.count();
+    m_strings.append(string);
+    m_ids.insert(string, id);
+    return id;
+}
+
+int KBookmarkStringPool::find(const QString &string) const
+{
+    if (string.isEmpty()) {
+        return 0;
+    }
+    return m_ids.value(string, -1);
+}
+
+void KBookmarkStringPool::clear()
+{
+    m_strings.clear();
+    m_ids.clear();
+    m_strings.append(QString());
+}
+
+//////
+
+static KBookmarkTree::BookmarkType bookmarkTypeForTag(const QString &tagName, bool isDocumentElement)
+{
+    if (tagName == QLatin1String("bookmark")) {
+        return KBookmarkTree::UrlType;
+    }
+    if (tagName == QLatin1String("folder")) {
+        return KBookmarkTree::FolderType;
+    }
+    if (tagName == QLatin1String("separator")) {
+        return KBookmarkTree::SeparatorType;
+    }
+    if (isDocumentElement || tagName == QLatin1String("xbel")) {
+        return KBookmarkTree::RootType;
+    }
+    return KBookmarkTree::NoBookmark;
+}
+
+KBookmarkTree::KBookmarkTree()
+{
+}
+
+void KBookmarkTree::clear()
+{
+    m_nodes.clear();
+    m_attributes.clear();
+    m_strings.clear();
+}
+
+void KBookmarkTree::reserve(int nodeCount)
+{
+    m_nodes.reserve(nodeCount);
+}
+
+int KBookmarkTree::appendNode(int parent, NodeType type, const QString &name)
+{
+    Q_ASSERT(parent >= 0 || m_nodes.isEmpty());
+
+    const int index = m_nodes.count();
+    Node node;
+    node.parent = parent;
+    node.firstChild = -1;
+    node.lastChild = -1;
+    node.nextSibling = -1;
+    node.previousSibling = -1;
+    node.firstAttribute = m_attributes.count();
+    node.attributeCount = 0;
+    node.name = m_strings.intern(name);
+    node.type = type;
+    node.bookmarkType = type == ElementNode ? bookmarkTypeForTag(name, parent < 0) : NoBookmark;
+    node.reserved = 0;
+
+    if (parent >= 0) {
+        Node &parentNode = m_nodes[parent];
+        node.previousSibling = parentNode.lastChild;
+        if (parentNode.lastChild >= 0) {
+            m_nodes[parentNode.lastChild].nextSibling = index;
+        } else {
+            parentNode.firstChild = index;
+        }
+        parentNode.lastChild = index;
+    }
+    m_nodes.append(node);
+    return index;
+}
+
+int KBookmarkTree::appendElement(int parent, const QString &tagName)
+{
+    return appendNode(parent, ElementNode, tagName);
+}
+
+int KBookmarkTree::appendText(int parent, const QString &text)
+{
+    return appendNode(parent, TextNode, text);
+}
+
+int KBookmarkTree::appendComment(int parent, const QString &text)
+{
+    return appendNode(parent, CommentNode, text);
+}
+
+QString KBookmarkTree::tagName(int element) const
+{
+    return m_strings.at(m_nodes.at(element).name);
+}
+
+QString KBookmarkTree::text(int element) const
+{
+    QString result;
+    for (int child = m_nodes.at(element).firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        const Node &node = m_nodes.at(child);
+        if (node.type == TextNode) {
+            result += m_strings.at(node.name);
+        } else if (node.type == ElementNode) {
+            result += text(child); // same as QDomElement::text()
+        }
+    }
+    return result;
+}
+
+QString KBookmarkTree::attribute(int element, const QString &name, const QString &defaultValue) const
+{
+    const int nameId = m_strings.find(name);
+    if (nameId < 0) {
+        return defaultValue;
+    }
+    const Node &node = m_nodes.at(element);
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        if (m_attributes.at(i).name == nameId) {
+            return m_strings.at(m_attributes.at(i).value);
+        }
+    }
+    return defaultValue;
+}
+
+bool KBookmarkTree::hasAttribute(int element, const QString &name) const
+{
+    const int nameId = m_strings.find(name);
+    if (nameId < 0) {
+        return false;
+    }
+    const Node &node = m_nodes.at(element);
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        if (m_attributes.at(i).name == nameId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void KBookmarkTree::setAttribute(int element, const QString &name, const QString &value)
+{
+    const int nameId = m_strings.intern(name);
+    const int valueId = m_strings.intern(value);
+    Node &node = m_nodes[element];
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        if (m_attributes.at(i).name == nameId) {
+            m_attributes[i].value = valueId;
+            return;
+        }
+    }
+    // The attributes of an element are stored contiguously. That's always the case while
+    // building the tree, otherwise move the attributes of this element to the end first.
+    if (node.firstAttribute + node.attributeCount != m_attributes.count()) {
+        const int first = m_attributes.count();
+        for (int i = 0; i < node.attributeCount; ++i) {
+            m_attributes.append(m_attributes.at(node.firstAttribute + i));
+        }
+        node.firstAttribute = first;
+    }
+    Attribute attribute;
+    attribute.name = nameId;
+    attribute.value = valueId;
+    m_attributes.append(attribute);
+    ++node.attributeCount;
+}
+
+void KBookmarkTree::removeAttribute(int element, const QString &name)
+{
+    const int nameId = m_strings.find(name);
+    if (nameId < 0) {
+        return;
+    }
+    Node &node = m_nodes[element];
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        if (m_attributes.at(i).name == nameId) {
+            // The order of attributes doesn't matter
+            m_attributes[i] = m_attributes.at(end - 1);
+            --node.attributeCount;
+            return;
+        }
+    }
+}
+
+void KBookmarkTree::setText(int element, const QString &text)
+{
+    for (int child = m_nodes.at(element).firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        if (m_nodes.at(child).type == TextNode) {
+            m_nodes[child].name = m_strings.intern(text);
+            return;
+        }
+    }
+    appendText(element, text);
+}
+
+int KBookmarkTree::firstChildElement(int element, const QString &tagName) const
+{
+    const int child = m_nodes.at(element).firstChild;
+    if (child < 0) {
+        return -1;
+    }
+    if (m_nodes.at(child).type == ElementNode
+            && (tagName.isEmpty() || m_strings.at(m_nodes.at(child).name) == tagName)) {
+        return child;
+    }
+    return nextSiblingElement(child, tagName);
+}
+
+int KBookmarkTree::nextSiblingElement(int node, const QString &tagName) const
+{
+    const int nameId = tagName.isEmpty() ? 0 : m_strings.find(tagName);
+    if (nameId < 0) {
+        return -1;
+    }
+    for (int sibling = m_nodes.at(node).nextSibling; sibling >= 0; sibling = m_nodes.at(sibling).nextSibling) {
+        const Node &siblingNode = m_nodes.at(sibling);
+        if (siblingNode.type == ElementNode && (nameId == 0 || siblingNode.name == nameId)) {
+            return sibling;
+        }
+    }
+    return -1;
+}
+
+int KBookmarkTree::firstBookmark(int group) const
+{
+    int child = m_nodes.at(group).firstChild;
+    while (child >= 0 && m_nodes.at(child).bookmarkType < FolderType) {
+        child = m_nodes.at(child).nextSibling;
+    }
+    return child;
+}
+
+int KBookmarkTree::nextBookmark(int node) const
+{
+    int sibling = m_nodes.at(node).nextSibling;
+    while (sibling >= 0 && m_nodes.at(sibling).bookmarkType < FolderType) {
+        sibling = m_nodes.at(sibling).nextSibling;
+    }
+    return sibling;
+}
+
+QString KBookmarkTree::fullText(int node) const
+{
+    const int title = firstChildElement(node, QStringLiteral("title"));
+    if (title < 0) {
+        return QString();
+    }
+    QString result = text(title);
+    result.replace(QLatin1Char('\n'), QLatin1Char(' ')); // #140673
+    return result;
+}
+
+KBookmarkTree KBookmarkTree::fromElement(const QDomElement &element)
+{
+    KBookmarkTree tree;
+    if (element.isNull()) {
+        return tree;
+    }
+    const int root = tree.appendElement(-1, element.tagName());
+    const QDomNamedNodeMap attributes = element.attributes();
+    for (int i = 0; i < attributes.count(); ++i) {
+        const QDomAttr attr = attributes.item(i).toAttr();
+        tree.setAttribute(root, attr.name(), attr.value());
+    }
+    tree.appendElementChildren(element, root);
+    return tree;
+}
+
+bool KBookmarkTree::isWhitespace(const QString &text)
+{
+    for (const QChar c : text) {
+        if (c != QLatin1Char(' ') && c != QLatin1Char('\t') && c != QLatin1Char('\n') && c != QLatin1Char('\r')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void KBookmarkTree::appendElementChildren(const QDomNode &domParent, int parent)
+{
+    for (QDomNode child = domParent.firstChild(); !child.isNull(); child = child.nextSibling()) {
+        if (child.isElement()) {
+            const QDomElement element = child.toElement();
+            const int index = appendElement(parent, element.tagName());
+            const QDomNamedNodeMap attributes = element.attributes();
+            for (int i = 0; i < attributes.count(); ++i) {
+                const QDomAttr attr = attributes.item(i).toAttr();
+                setAttribute(index, attr.name(), attr.value());
+            }
+            appendElementChildren(element, index);
+        } else if (child.isText()) { // includes CDATA sections
+            appendText(parent, child.nodeValue());
+        } else if (child.isComment()) {
+            appendComment(parent, child.nodeValue());
+        }
+    }
+}
+
+QDomElement KBookmarkTree::toElement(QDomDocument &doc, int element) const
+{
+    const Node &node = m_nodes.at(element);
+    Q_ASSERT(node.type == ElementNode);
+    QDomElement result = doc.createElement(m_strings.at(node.name));
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        const Attribute &attr = m_attributes.at(i);
+        result.setAttribute(m_strings.at(attr.name), m_strings.at(attr.value));
+    }
+    appendDomChildren(doc, result, element);
+    return result;
+}
+
+QDomNode KBookmarkTree::toNode(QDomDocument &doc, int node) const
+{
+    switch (m_nodes.at(node).type) {
+    case ElementNode:
+        return toElement(doc, node);
+    case TextNode:
+        return doc.createTextNode(m_strings.at(m_nodes.at(node).name));
+    case CommentNode:
+        return doc.createComment(m_strings.at(m_nodes.at(node).name));
+    }
+    return QDomNode();
+}
+
+void KBookmarkTree::appendDomChildren(QDomDocument &doc, QDomNode &domParent, int parent) const
+{
+    for (int child = m_nodes.at(parent).firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        domParent.appendChild(toNode(doc, child));
+    }
+}
+
+QDomElement KBookmarkTree::toShallowElement(QDomDocument &doc, int element) const
+{
+    const Node &node = m_nodes.at(element);
+    Q_ASSERT(node.type == ElementNode);
+    QDomElement result = doc.createElement(m_strings.at(node.name));
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        const Attribute &attr = m_attributes.at(i);
+        result.setAttribute(m_strings.at(attr.name), m_strings.at(attr.value));
+    }
+    for (int child = node.firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        if (m_nodes.at(child).bookmarkType < FolderType) {
+            result.appendChild(toNode(doc, child));
+        }
+    }
+    return result;
+}
+
+void KBookmarkTree::loadShallowChildren(QDomDocument &doc, QDomElement &domElement, int element,
+                                        QVector<QPair<QDomElement, int> > *shallowFolders) const
+{
+    // The DOM children are the other tree children, in the same order,
+    // unless they were modified in the meantime, then we can only come close.
+    QDomNode next = domElement.firstChild();
+    for (int child = m_nodes.at(element).firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        const quint8 type = m_nodes.at(child).bookmarkType;
+        if (type < FolderType) {
+            if (!next.isNull()) {
+                next = next.nextSibling();
+            }
+            continue;
+        }
+        QDomElement childElement;
+        if (type == FolderType) {
+            childElement = toShallowElement(doc, child);
+            shallowFolders->append(qMakePair(childElement, child));
+        } else {
+            childElement = toElement(doc, child);
+        }
+        if (next.isNull()) {
+            domElement.appendChild(childElement);
+        } else {
+            domElement.insertBefore(childElement, next);
+        }
+    }
+}
+
+static bool isBookmarkTag(const QString &tagName)
+{
+    return tagName == QLatin1String("folder") || tagName == QLatin1String("bookmark")
+           || tagName == QLatin1String("separator");
+}
+
+bool KBookmarkTree::isSameNode(int node, const QDomNode &domNode) const
+{
+    const Node &treeNode = m_nodes.at(node);
+    switch (treeNode.type) {
+    case ElementNode:
+        return domNode.isElement() && isSameElement(node, domNode.toElement(), false);
+    case TextNode:
+        return domNode.isText() && domNode.nodeValue() == m_strings.at(treeNode.name);
+    case CommentNode:
+        return domNode.isComment() && domNode.nodeValue() == m_strings.at(treeNode.name);
+    }
+    return false;
+}
+
+bool KBookmarkTree::isSameShallowElement(int element, const QDomElement &domElement) const
+{
+    return isSameElement(element, domElement, true);
+}
+
+bool KBookmarkTree::isSameElement(int element, const QDomElement &domElement, bool shallow) const
+{
+    const Node &node = m_nodes.at(element);
+    if (domElement.tagName() != m_strings.at(node.name)
+            || domElement.attributes().count() != node.attributeCount) {
+        return false;
+    }
+    for (int i = node.firstAttribute, end = node.firstAttribute + node.attributeCount; i < end; ++i) {
+        const QString &name = m_strings.at(m_attributes.at(i).name);
+        if (!domElement.hasAttribute(name) || domElement.attribute(name) != m_strings.at(m_attributes.at(i).value)) {
+            return false;
+        }
+    }
+
+    int child = node.firstChild;
+    QDomNode domChild = domElement.firstChild();
+    for (;;) {
+        if (shallow) {
+            while (child >= 0 && m_nodes.at(child).bookmarkType >= FolderType) {
+                child = m_nodes.at(child).nextSibling;
+            }
+            while (!domChild.isNull() && domChild.isElement() && isBookmarkTag(domChild.toElement().tagName())) {
+                domChild = domChild.nextSibling();
+            }
+        }
+        if (child < 0 || domChild.isNull()) {
+            return child < 0 && domChild.isNull();
+        }
+        if (!isSameNode(child, domChild)) {
+            return false;
+        }
+        child = m_nodes.at(child).nextSibling;
+        domChild = domChild.nextSibling();
+    }
+}
+
+bool KBookmarkTree::containsToolbar(int element) const
+{
+    if (attribute(element, QStringLiteral("toolbar")) == QLatin1String("yes")) {
+        return true;
+    }
+    for (int child = m_nodes.at(element).firstChild; child >= 0; child = m_nodes.at(child).nextSibling) {
+        if (m_nodes.at(child).bookmarkType == FolderType && containsToolbar(child)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,262 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKTREE_P_H
+#define KBOOKMARKTREE_P_H
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QHash>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+/**
+ * Interns the strings of a bookmark tree.
+ * Tag names, attribute names and most attribute values (icons, mime types,
+ * metadata owners...) repeat thousands of times in a large collection,
+ * so every distinct string is only stored once. Id 0 is the empty string.
+ * @internal
+ */
+class KBookmarkStringPool
+{
+public:
+    KBookmarkStringPool();
+
+    int intern(const QString &string);
+    /**
+     * @return the id of @p string, or -1 if it was never interned
+     */
+    int find(const QString &string) const;
+    const QString &at(int id) const
+    {
+        return m_strings.at(id);
+    }
+    int count() const
+    {
+        return m_strings.count();
+    }
+    void clear();
+
+private:
+    friend class KBookmarkBinaryCache;
+    QVector<QString> m_strings;
+    QHash<QString, int> m_ids;
+};
+
+/**
+ * An arena allocated XML element tree holding a parsed bookmark file.
+ *
+ * All nodes live in one flat vector and refer to each other by index, strings
+ * are interned in a KBookmarkStringPool, and the bookmark accessors (type,
+ * title, ...) do not compare tag name strings.
+ *
+ * KBookmark is a wrapper around a QDomElement (and has to stay so for binary
+ * compatibility), so this is not a replacement for the DOM: it is what the
+ * file is parsed into (by the reader, the binary cache and the reparse diff),
+ * and the store lazy loading creates folders from. The manager keeps a freshly
+ * loaded file in this form until somebody needs the QDomDocument, answering
+ * KBookmarkManager::snapshot() and the toolbar search from it meanwhile.
+ *
+ * This doesn't make the DOM any smaller: once root() was called, only the
+ * folders lazy loading didn't create yet are kept in the tree instead of the
+ * DOM. Without lazy loading, the tree is dropped as soon as the DOM is built,
+ * and while building it, both exist at the same time.
+ * @internal
+ */
+class KBookmarkTree
+{
+public:
+    enum NodeType {
+        ElementNode,
+        TextNode,
+        CommentNode
+    };
+
+    enum BookmarkType {
+        NoBookmark, ///< an element which isn't a bookmark, e.g. \<title\> or \<info\>
+        RootType,   ///< the toplevel \<xbel\> element
+        FolderType,
+        UrlType,    ///< a \<bookmark\>
+        SeparatorType
+    };
+
+    // Fixed size members only, so that node tables can be copied around as is
+    struct Node {
+        qint32 parent;
+        qint32 firstChild;
+        qint32 lastChild;
+        qint32 nextSibling;
+        qint32 previousSibling;
+        qint32 firstAttribute;
+        qint32 attributeCount;
+        qint32 name; // the tag name for elements, the content for text and comment nodes
+        quint8 type;
+        quint8 bookmarkType;
+        quint16 reserved;
+    };
+
+    struct Attribute {
+        qint32 name;
+        qint32 value;
+    };
+
+    KBookmarkTree();
+
+    bool isEmpty() const
+    {
+        return m_nodes.isEmpty();
+    }
+    int count() const
+    {
+        return m_nodes.count();
+    }
+    void clear();
+    void reserve(int nodeCount);
+
+    /**
+     * Appends a new element as last child of @p parent.
+     * Pass -1 as @p parent to create the document element.
+     * @return the index of the new element
+     */
+    int appendElement(int parent, const QString &tagName);
+    int appendText(int parent, const QString &text);
+    int appendComment(int parent, const QString &text);
+
+    const Node &node(int index) const
+    {
+        return m_nodes.at(index);
+    }
+    const Attribute &attributeAt(int index) const
+    {
+        return m_attributes.at(index);
+    }
+    /**
+     * @return the index of the toplevel element, -1 for an empty tree
+     */
+    int documentElement() const
+    {
+        return m_nodes.isEmpty() ? -1 : 0;
+    }
+
+    QString tagName(int element) const;
+    /**
+     * @return the concatenated text children of @p element
+     */
+    QString text(int element) const;
+    QString attribute(int element, const QString &name, const QString &defaultValue = QString()) const;
+    bool hasAttribute(int element, const QString &name) const;
+    void setAttribute(int element, const QString &name, const QString &value);
+    void removeAttribute(int element, const QString &name);
+    /**
+     * Replaces the first text child of @p element, or appends one
+     */
+    void setText(int element, const QString &text);
+
+    int firstChildElement(int element, const QString &tagName = QString()) const;
+    int nextSiblingElement(int node, const QString &tagName = QString()) const;
+
+    KBookmarkTree::BookmarkType bookmarkType(int node) const
+    {
+        return static_cast<KBookmarkTree::BookmarkType>(m_nodes.at(node).bookmarkType);
+    }
+    bool isGroup(int node) const
+    {
+        const quint8 type = m_nodes.at(node).bookmarkType;
+        return type == RootType || type == FolderType;
+    }
+    /**
+     * Same as KBookmarkGroup::first(): the first folder, bookmark or separator child
+     */
+    int firstBookmark(int group) const;
+    /**
+     * Same as KBookmarkGroup::next()
+     */
+    int nextBookmark(int node) const;
+    /**
+     * Same as KBookmark::fullText() for non-separators
+     */
+    QString fullText(int node) const;
+
+    const KBookmarkStringPool &strings() const
+    {
+        return m_strings;
+    }
+
+    /**
+     * Builds a tree holding a copy of @p element and its descendants
+     */
+    static KBookmarkTree fromElement(const QDomElement &element);
+    /**
+     * @return whether @p text only consists of XML whitespace: such text
+     * between the nodes of a file is indentation, and doesn't get a text node
+     */
+    static bool isWhitespace(const QString &text);
+    /**
+     * Creates a DOM copy of @p element and its descendants, owned by @p doc
+     */
+    QDomElement toElement(QDomDocument &doc, int element) const;
+    /**
+     * Same as toElement(), for any kind of node
+     */
+    QDomNode toNode(QDomDocument &doc, int node) const;
+
+    /**
+     * @return true if @p domNode is a copy of @p node and its descendants
+     */
+    bool isSameNode(int node, const QDomNode &domNode) const;
+    /**
+     * Same as isSameNode(), but ignores the folders, bookmarks and separators
+     * below @p element.
+     */
+    bool isSameShallowElement(int element, const QDomElement &domElement) const;
+
+    /**
+     * Same as toElement(), but without the folders, bookmarks and separators
+     * below @p element. Used for loading folders lazily.
+     */
+    QDomElement toShallowElement(QDomDocument &doc, int element) const;
+    /**
+     * Inserts the folders, bookmarks and separators of @p element into its
+     * shallow copy @p domElement, between the other children as in the tree.
+     * Folders are created shallow and appended to @p shallowFolders.
+     */
+    void loadShallowChildren(QDomDocument &doc, QDomElement &domElement, int element,
+                             QVector<QPair<QDomElement, int> > *shallowFolders) const;
+    /**
+     * @return true if @p element or a folder below it has the toolbar attribute set
+     */
+    bool containsToolbar(int element) const;
+
+private:
+    friend class KBookmarkBinaryCache;
+    int appendNode(int parent, NodeType type, const QString &name);
+    void appendElementChildren(const QDomNode &domParent, int parent);
+    void appendDomChildren(QDomDocument &doc, QDomNode &domParent, int parent) const;
+    bool isSameElement(int element, const QDomElement &domElement, bool shallow) const;
+
+    QVector<Node> m_nodes;
+    QVector<Attribute> m_attributes;
+    KBookmarkStringPool m_strings;
+};
+
+Q_DECLARE_TYPEINFO(KBookmarkTree::Node, Q_PRIMITIVE_TYPE);
+Q_DECLARE_TYPEINFO(KBookmarkTree::Attribute, Q_PRIMITIVE_TYPE);
+
+#endif
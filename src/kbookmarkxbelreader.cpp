@@ -0,0 +1,83 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "kbookmarkxbelreader_p.h"
+
+#include <QXmlStreamReader>
+
+bool KBookmarkXbelReader::read(QIODevice *device, KBookmarkTree *tree, QString *errorString)
+{
+    tree->clear();
+    QXmlStreamReader reader(device);
+    // Like QDom by default: qualified names, xmlns attributes kept as such
+    reader.setNamespaceProcessing(false);
+
+    int current = -1;
+    // Consecutive text and CDATA sections make a single text node
+    QString text;
+    while (!reader.atEnd()) {
+        const QXmlStreamReader::TokenType token = reader.readNext();
+        if (token != QXmlStreamReader::Characters && !text.isEmpty()) {
+            if (current >= 0 && !KBookmarkTree::isWhitespace(text)) {
+                tree->appendText(current, text);
+            }
+            text.clear();
+        }
+        switch (token) {
+        case QXmlStreamReader::StartElement: {
+            current = tree->appendElement(current, reader.qualifiedName().toString());
+            const QXmlStreamNamespaceDeclarations namespaces = reader.namespaceDeclarations();
+            for (const QXmlStreamNamespaceDeclaration &ns : namespaces) {
+                const QString name = ns.prefix().isEmpty() ? QStringLiteral("xmlns") : QLatin1String("xmlns:") + ns.prefix();
+                tree->setAttribute(current, name, ns.namespaceUri().toString());
+            }
+            const QXmlStreamAttributes attributes = reader.attributes();
+            for (const QXmlStreamAttribute &attr : attributes) {
+                tree->setAttribute(current, attr.qualifiedName().toString(), attr.value().toString());
+            }
+            break;
+        }
+        case QXmlStreamReader::EndElement:
+            current = tree->node(current).parent;
+            if (current < 0) {
+                return true; // done, tolerate whatever garbage follows
+            }
+            break;
+        case QXmlStreamReader::Characters: // includes CDATA sections
+            if (current >= 0) {
+                text += reader.text();
+            }
+            break;
+        case QXmlStreamReader::Comment:
+            if (current >= 0) {
+                tree->appendComment(current, reader.text().toString());
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (reader.hasError()) {
+        *errorString = QStringLiteral("%1 (line %2, column %3)").arg(reader.errorString())
+                       .arg(reader.lineNumber()).arg(reader.columnNumber());
+        return false;
+    }
+    return true;
+}
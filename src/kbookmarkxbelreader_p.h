@@ -0,0 +1,49 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KBOOKMARKXBELREADER_P_H
+#define KBOOKMARKXBELREADER_P_H
+
+#include "kbookmarktree_p.h"
+
+class QIODevice;
+
+/**
+ * Loads an XBEL file into a KBookmarkTree in one pass over QXmlStreamReader
+ * events, without a QDomDocument or the whole file in memory.
+ *
+ * The result is the same as reading the file with QDomDocument::setContent()
+ * (no namespace processing, whitespace-only text dropped) and converting
+ * the document element with KBookmarkTree::fromElement().
+ * @internal
+ */
+class KBookmarkXbelReader
+{
+public:
+    /**
+     * Reads the document in @p device into @p tree.
+     * Reading stops at the end of the document element, anything after
+     * it is ignored.
+     * @return false if the document is malformed; @p tree then holds
+     * everything up to the error and @p errorString tells where it is
+     */
+    static bool read(QIODevice *device, KBookmarkTree *tree, QString *errorString);
+};
+
+#endif
@@ -0,0 +1,320 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "kbookmarkxbelwriter_p.h"
+#include "kbookmarktree_p.h"
+
+#include <QDomDocument>
+#include <QDomDocumentType>
+#include <QDomElement>
+#include <QDomNamedNodeMap>
+#include <QIODevice>
+#include <QTextStream>
+
+namespace
+{
+enum {
+    ChunkSize = 64 * 1024
+};
+
+enum Escaping {
+    NoEscaping,
+    TextEscaping,
+    AttributeEscaping
+};
+}
+
+KBookmarkXbelWriter::KBookmarkXbelWriter(QIODevice *device)
+    : m_device(device)
+    , m_hash(QCryptographicHash::Sha1)
+    , m_bytesWritten(0)
+    , m_ok(true)
+    , m_tree(nullptr)
+    , m_treeParent(-1)
+{
+    m_buffer.reserve(ChunkSize + 64);
+}
+
+void KBookmarkXbelWriter::setTree(KBookmarkTree *tree)
+{
+    m_tree = tree;
+    m_treeParent = -1;
+}
+
+void KBookmarkXbelWriter::writeDocument(const QDomDocument &doc)
+{
+    // Same order as QDomDocument::toString(): the XML declaration comes
+    // before the document type, which isn't one of the child nodes
+    QDomNode node = doc.firstChild();
+    if (node.isProcessingInstruction() && node.nodeName() == QLatin1String("xml")) {
+        writeNode(node, 0);
+        node = node.nextSibling();
+    }
+    const QDomDocumentType type = doc.doctype();
+    if (!type.name().isEmpty()) {
+        writeLatin1("<!DOCTYPE ");
+        writeString(type.name(), NoEscaping);
+        if (!type.publicId().isEmpty()) {
+            writeLatin1(" PUBLIC \"");
+            writeString(type.publicId(), NoEscaping);
+            writeLatin1("\" \"");
+            writeString(type.systemId(), NoEscaping);
+            writeLatin1("\"");
+        } else if (!type.systemId().isEmpty()) {
+            writeLatin1(" SYSTEM \"");
+            writeString(type.systemId(), NoEscaping);
+            writeLatin1("\"");
+        }
+        if (!type.internalSubset().isEmpty()) {
+            writeLatin1(" [");
+            writeString(type.internalSubset(), NoEscaping);
+            writeLatin1("]");
+        }
+        writeLatin1(">\n");
+    }
+    for (; !node.isNull(); node = node.nextSibling()) {
+        if (!node.isDocumentType()) {
+            writeNode(node, 0);
+        }
+    }
+}
+
+void KBookmarkXbelWriter::writeElement(const QDomElement &element)
+{
+    if (!element.isNull()) {
+        writeNode(element, 0);
+    }
+}
+
+static bool isTextOrCDATA(const QDomNode &node)
+{
+    return node.nodeType() == QDomNode::TextNode || node.nodeType() == QDomNode::CDATASectionNode;
+}
+
+// Reading the file back merges consecutive text and CDATA sections into one
+// text node, and drops the ones only consisting of whitespace: so does the tree
+void KBookmarkXbelWriter::appendTreeText(const QDomNode &node)
+{
+    if (!m_tree || m_treeParent < 0 || isTextOrCDATA(node.previousSibling())) {
+        return;
+    }
+    QString text;
+    for (QDomNode sibling = node; isTextOrCDATA(sibling); sibling = sibling.nextSibling()) {
+        text += sibling.nodeValue();
+    }
+    if (!KBookmarkTree::isWhitespace(text)) {
+        m_tree->appendText(m_treeParent, text);
+    }
+}
+
+void KBookmarkXbelWriter::writeNode(const QDomNode &node, int depth)
+{
+    // Indentation and line breaks as QDomNode::save() with an indentation of 1:
+    // none around text, which would change it otherwise
+    switch (node.nodeType()) {
+    case QDomNode::ElementNode: {
+        const QString name = node.nodeName();
+        if (!node.previousSibling().isText()) {
+            writeIndentation(depth);
+        }
+        // The first toplevel element is the document element
+        int treeNode = -1;
+        if (m_tree && (m_treeParent >= 0 || m_tree->isEmpty())) {
+            treeNode = m_tree->appendElement(m_treeParent, name);
+        }
+        writeLatin1("<");
+        writeString(name, NoEscaping);
+        const QDomNamedNodeMap attributes = node.attributes();
+        for (int i = 0; i < attributes.count(); ++i) {
+            const QDomNode attribute = attributes.item(i);
+            const QString attributeName = attribute.nodeName();
+            const QString value = attribute.nodeValue();
+            writeLatin1(" ");
+            writeString(attributeName, NoEscaping);
+            writeLatin1("=\"");
+            writeString(value, AttributeEscaping);
+            writeLatin1("\"");
+            if (treeNode >= 0) {
+                m_tree->setAttribute(treeNode, attributeName, value);
+            }
+        }
+        if (node.hasChildNodes()) {
+            writeLatin1(node.firstChild().isText() ? ">" : ">\n");
+            const int treeParent = m_treeParent;
+            m_treeParent = treeNode;
+            for (QDomNode child = node.firstChild(); !child.isNull(); child = child.nextSibling()) {
+                writeNode(child, depth + 1);
+            }
+            m_treeParent = treeParent;
+            if (!node.lastChild().isText()) {
+                writeIndentation(depth);
+            }
+            writeLatin1("</");
+            writeString(name, NoEscaping);
+            writeLatin1(">");
+        } else {
+            writeLatin1("/>");
+        }
+        if (!node.nextSibling().isText()) {
+            writeLatin1("\n");
+        }
+        break;
+    }
+    case QDomNode::TextNode:
+        writeString(node.nodeValue(), TextEscaping);
+        appendTreeText(node);
+        break;
+    case QDomNode::CDATASectionNode:
+        writeLatin1("<![CDATA[");
+        writeString(node.nodeValue(), NoEscaping);
+        writeLatin1("]]>");
+        appendTreeText(node);
+        break;
+    case QDomNode::CommentNode: {
+        const QString value = node.nodeValue();
+        if (m_tree && m_treeParent >= 0) {
+            m_tree->appendComment(m_treeParent, value);
+        }
+        writeLatin1("<!--");
+        writeString(value, NoEscaping);
+        writeLatin1(value.endsWith(QLatin1Char('-')) ? " -->" : "-->");
+        if (!node.nextSibling().isText()) {
+            writeLatin1("\n");
+        }
+        break;
+    }
+    case QDomNode::ProcessingInstructionNode:
+        writeLatin1("<?");
+        writeString(node.nodeName(), NoEscaping);
+        writeLatin1(" ");
+        writeString(node.nodeValue(), NoEscaping);
+        writeLatin1("?>\n");
+        break;
+    default: {
+        // Nothing the bookmark code creates, leave it to QDom
+        QString str;
+        QTextStream stream(&str, QIODevice::WriteOnly);
+        node.save(stream, 1);
+        stream.flush();
+        writeString(str, NoEscaping);
+        break;
+    }
+    }
+}
+
+void KBookmarkXbelWriter::writeIndentation(int depth)
+{
+    m_buffer.append(depth, ' ');
+}
+
+void KBookmarkXbelWriter::writeLatin1(const char *str)
+{
+    m_buffer.append(str);
+}
+
+void KBookmarkXbelWriter::writeString(const QString &str, int escaping)
+{
+    // UTF-8, encoded right into the buffer: no temporary QByteArray per string
+    const QChar *it = str.constData();
+    const QChar *const end = it + str.size();
+    for (; it != end; ++it) {
+        if (m_buffer.size() >= ChunkSize) {
+            flush();
+        }
+        const ushort c = it->unicode();
+        if (c < 0x80) {
+            if (escaping != NoEscaping) {
+                switch (c) {
+                case '<':
+                    m_buffer.append("&lt;");
+                    continue;
+                case '>':
+                    m_buffer.append("&gt;");
+                    continue;
+                case '&':
+                    m_buffer.append("&amp;");
+                    continue;
+                case '\r':
+                    m_buffer.append("&#xd;");
+                    continue;
+                }
+            }
+            if (escaping == AttributeEscaping) {
+                // Attribute value normalization would turn these into spaces
+                switch (c) {
+                case '"':
+                    m_buffer.append("&quot;");
+                    continue;
+                case '\n':
+                    m_buffer.append("&#xa;");
+                    continue;
+                case '\t':
+                    m_buffer.append("&#x9;");
+                    continue;
+                }
+            }
+            m_buffer.append(char(c));
+        } else if (c < 0x800) {
+            m_buffer.append(char(0xc0 | (c >> 6)));
+            m_buffer.append(char(0x80 | (c & 0x3f)));
+        } else if (QChar::isHighSurrogate(c) && it + 1 != end && (it + 1)->isLowSurrogate()) {
+            const uint ucs4 = QChar::surrogateToUcs4(c, (++it)->unicode());
+            m_buffer.append(char(0xf0 | (ucs4 >> 18)));
+            m_buffer.append(char(0x80 | ((ucs4 >> 12) & 0x3f)));
+            m_buffer.append(char(0x80 | ((ucs4 >> 6) & 0x3f)));
+            m_buffer.append(char(0x80 | (ucs4 & 0x3f)));
+        } else if (QChar::isSurrogate(c)) {
+            m_buffer.append("\xef\xbf\xbd"); // U+FFFD, same as QString::toUtf8()
+        } else {
+            m_buffer.append(char(0xe0 | (c >> 12)));
+            m_buffer.append(char(0x80 | ((c >> 6) & 0x3f)));
+            m_buffer.append(char(0x80 | (c & 0x3f)));
+        }
+    }
+}
+
+void KBookmarkXbelWriter::flush()
+{
+    if (m_buffer.isEmpty()) {
+        return;
+    }
+    m_hash.addData(m_buffer);
+    if (m_device->write(m_buffer) != m_buffer.size()) {
+        m_ok = false;
+    }
+    m_bytesWritten += m_buffer.size();
+    m_buffer.resize(0); // keeps the reserved capacity
+}
+
+bool KBookmarkXbelWriter::finish()
+{
+    flush();
+    return m_ok;
+}
+
+QByteArray KBookmarkXbelWriter::hash() const
+{
+    return m_hash.result();
+}
+
+qint64 KBookmarkXbelWriter::bytesWritten() const
+{
+    return m_bytesWritten;
+}
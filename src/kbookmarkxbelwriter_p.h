@@ -0,0 +1,90 @@
+//  -*- c-basic-offset:4; indent-tabs-mode:nil -*-
+/* This file is part of the KDE libraries
+   Copyright (C) 2018 KBookmarks authors
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public
+   License version 2 as published by the Free Software Foundation.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public License
+   along with this library; see the file COPYING.LIB.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef KBOOKMARKXBELWRITER_P_H
+#define KBOOKMARKXBELWRITER_P_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QDomNode>
+
+class KBookmarkTree;
+class QIODevice;
+
+/**
+ * Writes a bookmark document as UTF-8 straight into a device, in chunks,
+ * instead of serializing it into one QString with QDomDocument::toString().
+ *
+ * The output is the same as the one of QDomDocument::toString(), except
+ * for escaping '>' everywhere, so it can be read by both QDomDocument and
+ * KBookmarkXbelReader. Only reads the document, so it can run in any
+ * thread as long as nobody else uses it.
+ * @internal
+ */
+class KBookmarkXbelWriter
+{
+public:
+    explicit KBookmarkXbelWriter(QIODevice *device);
+
+    /**
+     * Also appends the document element written next to @p tree, while
+     * walking the document anyway: the same as KBookmarkTree::fromElement()
+     * without a second pass, see KBookmarkBinaryCache
+     */
+    void setTree(KBookmarkTree *tree);
+
+    /**
+     * Writes @p doc: the XML declaration, the document type and the nodes
+     */
+    void writeDocument(const QDomDocument &doc);
+    /**
+     * Writes @p element and everything below it, as a document on its own
+     */
+    void writeElement(const QDomElement &element);
+    /**
+     * Writes what is still buffered.
+     * @return false if the device didn't take everything
+     */
+    bool finish();
+
+    /**
+     * @return the SHA-1 of everything written so far, see KBookmarkBinaryCache
+     */
+    QByteArray hash() const;
+    qint64 bytesWritten() const;
+
+private:
+    void writeNode(const QDomNode &node, int depth);
+    void appendTreeText(const QDomNode &node);
+    void writeIndentation(int depth);
+    void writeLatin1(const char *str);
+    void writeString(const QString &str, int escaping);
+    void flush();
+
+    QIODevice *m_device;
+    QByteArray m_buffer;
+    QCryptographicHash m_hash;
+    qint64 m_bytesWritten;
+    bool m_ok;
+    KBookmarkTree *m_tree;
+    int m_treeParent; // the node the nodes being written go to, -1 outside of the document element
+};
+
+#endif